@@ -0,0 +1,95 @@
+#include "asset_pack.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static uint64_t pixels_offset(uint32_t entries)
+{
+    uint64_t offset = sizeof(Asset_Pack_Header) +
+                      (uint64_t)entries * sizeof(Asset_Pack_Entry);
+    return (offset + ASSET_PACK_ALIGN - 1) / ASSET_PACK_ALIGN *
+           ASSET_PACK_ALIGN;
+}
+
+/*
+ * Maps the pack at `path` read-only and checks that the header, the index
+ * and the pixels all fit in the file, entry names are terminated. Returns -1
+ * if the file can't be mapped or is not a pack of this version, nothing is
+ * left mapped then.
+ */
+int asset_pack_open(Asset_Pack *pack, const char *path)
+{
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(Asset_Pack_Header))
+        goto err;
+
+    pack->size = st.st_size;
+    pack->map  = mmap(NULL, pack->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (pack->map == MAP_FAILED) goto err;
+    close(fd);
+    // Start reading the pixels in now, rather than page by page on upload
+    madvise(pack->map, pack->size, MADV_WILLNEED);
+
+    pack->header = pack->map;
+    pack->entries =
+        (const Asset_Pack_Entry *)((const unsigned char *)pack->map +
+                                   sizeof(Asset_Pack_Header));
+
+    const Asset_Pack_Header *header = pack->header;
+    if (header->magic != ASSET_PACK_MAGIC ||
+        header->version != ASSET_PACK_VERSION)
+        goto unmap;
+    if (header->pixels_offset != pixels_offset(header->entries) ||
+        header->pixels_size > pack->size ||
+        header->pixels_offset > pack->size - header->pixels_size)
+        goto unmap;
+    for (uint32_t i = 0; i < header->entries; ++i)
+        if (!memchr(pack->entries[i].name, '\0', ASSET_PACK_NAME_SIZE))
+            goto unmap;
+
+    pack->pixels = (const unsigned char *)pack->map + header->pixels_offset;
+    return 0;
+
+unmap:
+
+    munmap(pack->map, pack->size);
+    return -1;
+
+err:
+
+    close(fd);
+    return -1;
+}
+
+void asset_pack_close(Asset_Pack *pack) { munmap(pack->map, pack->size); }
+
+// Writes a pack, the header offsets are filled in here from the entries
+int asset_pack_write(const char *path, const Asset_Pack_Header *header,
+                     const Asset_Pack_Entry *entries, const void *pixels)
+{
+    static const unsigned char padding[ASSET_PACK_ALIGN] = {0};
+    Asset_Pack_Header out = *header;
+    out.magic             = ASSET_PACK_MAGIC;
+    out.version           = ASSET_PACK_VERSION;
+    out.pixels_offset     = pixels_offset(out.entries);
+    size_t index          = sizeof(out) + out.entries * sizeof(*entries);
+
+    FILE *fp              = fopen(path, "wb");
+    if (!fp) return -1;
+    if (fwrite(&out, sizeof(out), 1, fp) != 1 ||
+        fwrite(entries, sizeof(*entries), out.entries, fp) != out.entries ||
+        fwrite(padding, 1, out.pixels_offset - index, fp) !=
+            out.pixels_offset - index ||
+        fwrite(pixels, 1, out.pixels_size, fp) != out.pixels_size) {
+        fclose(fp);
+        return -1;
+    }
+
+    return fclose(fp) == 0 ? 0 : -1;
+}
@@ -0,0 +1,52 @@
+#ifndef ASSET_PACK_H
+#define ASSET_PACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ASSET_PACK_MAGIC     0x4b505442  // "BTPK" read as little-endian
+#define ASSET_PACK_VERSION   1
+#define ASSET_PACK_NAME_SIZE 64
+// Pixels start on a cache line, whatever the number of entries
+#define ASSET_PACK_ALIGN     64
+
+/*
+ * Single file of pre-decoded sprites baked by battletank-pack: this header,
+ * `entries` index records, then at `pixels_offset` the atlas the entries
+ * point into, `width` x `height` pixels in the raylib PixelFormat `format`,
+ * ready to upload as they are. Everything is in the byte order of the
+ * machine that baked it, a pack from a different one fails the magic check.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entries;
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;
+    uint64_t pixels_offset;
+    uint64_t pixels_size;
+} Asset_Pack_Header;
+
+// A sprite, its Sprite_Kind, file name and where its pixels are in the atlas
+typedef struct {
+    uint32_t kind;
+    float x, y, width, height;
+    char name[ASSET_PACK_NAME_SIZE];
+} Asset_Pack_Entry;
+
+// A pack mapped in memory, valid until asset_pack_close
+typedef struct {
+    const Asset_Pack_Header *header;
+    const Asset_Pack_Entry *entries;
+    const unsigned char *pixels;
+    void *map;
+    size_t size;
+} Asset_Pack;
+
+int asset_pack_open(Asset_Pack *pack, const char *path);
+void asset_pack_close(Asset_Pack *pack);
+int asset_pack_write(const char *path, const Asset_Pack_Header *header,
+                     const Asset_Pack_Entry *entries, const void *pixels);
+
+#endif
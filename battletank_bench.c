@@ -0,0 +1,487 @@
+/*
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                    Version 2, December 2004
+ *
+ * Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ * Everyone is permitted to copy and distribute verbatim or modified
+ * copies of this license document, and changing it is allowed as long
+ * as the name is changed.
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *   TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *  0. You just DO WHAT THE FUCK YOU WANT TO.
+ *
+ * Protocol micro benchmarks and size regression checks.
+ *
+ * Every snapshot codec is run over a few simulated matches (scenarios), each
+ * one a sequence of game states recorded tick by tick, measuring the bytes
+ * per snapshot and the encode and decode time per snapshot. The frames are
+ * encoded and decoded in order, as they would travel over a connection, so
+ * that codecs keeping history between snapshots behave as in a real match.
+ * The I32 field codec is cross-checked against the reference one and both
+ * are timed on their own, in MB/s.
+ *
+ * Results are printed as JSON on stdout and checked against the thresholds
+ * table below, any regression is reported on stderr and makes the run exit
+ * with a failure.
+ *
+ * Usage: battletank-bench [-l] [-s <time scale>]
+ *
+ * -l  only print the snapshot wire layout
+ * -s  multiply the time thresholds, for instrumented or slower builds
+ */
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "game_state.h"
+#include "protocol.h"
+
+#define BUFSIZE       2048
+#define TICKS         512
+#define ROUNDS        200
+#define CODEC_INTS    4096
+#define CODEC_ROUNDS  2000
+#define CODEC_SAMPLES 100000
+
+// Keeps the compiler from optimizing away the decoded values
+static volatile long sink;
+
+// Makes every store to `p` happen, and happen again next round, without it
+// a loop whose result is only partly used is partly skipped
+#define CLOBBER(p) __asm__ __volatile__("" : : "r"(p) : "memory")
+
+static unsigned long long get_nanoseconds_timestamp(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * SCENARIOS
+ * =========
+ * Matches recorded tick by tick with a fixed seed, tanks mostly keep their
+ * direction and fire once every `fire_every` ticks on average (0 never).
+ */
+typedef struct {
+    const char *name;
+    size_t players;
+    bool moving;
+    int fire_every;
+} Scenario;
+
+static const Scenario scenarios[] = {
+    {"empty", 0, false, 0},
+    {"idle", MAX_PLAYERS, false, 0},
+    {"full", MAX_PLAYERS, true, 20},
+    {"bullet_heavy", MAX_PLAYERS, true, 1},
+};
+
+#define SCENARIOS_COUNT (sizeof(scenarios) / sizeof(scenarios[0]))
+
+static void record_match(const Scenario *scenario, Game_State *states)
+{
+    Game_State state;
+
+    srand(42);
+    game_state_init(&state);
+    for (size_t i = 0; i < scenario->players; ++i)
+        game_state_spawn_tank(&state, i);
+    game_state_generate_power_up(&state);
+
+    for (int t = 0; t < TICKS; ++t) {
+        for (size_t i = 0; i < scenario->players; ++i) {
+            unsigned action = IDLE;
+            if (scenario->moving)
+                action = rand() % 8 == 0 ? (unsigned)(rand() % 5)
+                                         : state.players[i].direction;
+            if (scenario->fire_every && rand() % scenario->fire_every == 0)
+                action = FIRE;
+            game_state_update_tank(&state, i, action);
+        }
+        game_state_update(&state);
+        states[t] = state;
+    }
+}
+
+/*
+ * CODECS
+ * ======
+ * Every way a snapshot can be put on the wire and read back by the client,
+ * the context carries whatever a codec keeps between snapshots of the same
+ * connection and is reset before every pass over a match.
+ */
+typedef struct {
+    Compress_Context encoder;
+    Compress_Context decoder;
+    unsigned char scratch[BUFSIZE];
+} Codec_Context;
+
+typedef struct {
+    const char *name;
+    int (*encode)(Codec_Context *, const Game_State *, unsigned char *);
+    int (*decode)(Codec_Context *, const unsigned char *, size_t,
+                  Game_State *);
+} Codec;
+
+static int encode_legacy(Codec_Context *ctx, const Game_State *state,
+                         unsigned char *buf)
+{
+    (void)ctx;
+    return protocol_serialize_game_state(state, buf);
+}
+
+static int decode_legacy(Codec_Context *ctx, const unsigned char *buf,
+                         size_t len, Game_State *state)
+{
+    (void)ctx;
+    return protocol_deserialize_game_state(buf, len, state);
+}
+
+static int encode_snapshot(Codec_Context *ctx, const Game_State *state,
+                           unsigned char *buf)
+{
+    (void)ctx;
+    return protocol_serialize_snapshot(state, PROTOCOL_VERSION, buf);
+}
+
+static int decode_snapshot(Codec_Context *ctx, const unsigned char *buf,
+                           size_t len, Game_State *state)
+{
+    (void)ctx;
+    return protocol_deserialize_snapshot(buf, len, PROTOCOL_VERSION, state);
+}
+
+// What the client render path does, validation and a walk over the live
+// entities straight out of the frame
+static int decode_view(Codec_Context *ctx, const unsigned char *buf,
+                       size_t len, Game_State *state)
+{
+    (void)ctx;
+    (void)state;
+    Snapshot_View view;
+    if (protocol_snapshot_view(buf, len, PROTOCOL_VERSION, &view) < 0)
+        return -1;
+
+    long acc = 0;
+    for (size_t t = 0; t < view.tanks_count; ++t)
+        acc += snapshot_view_tank_x(&view, t) + snapshot_view_tank_y(&view, t) +
+               snapshot_view_tank_hp(&view, t);
+    for (size_t b = 0; b < view.bullets_count; ++b)
+        acc += snapshot_view_bullet_x(&view, b) +
+               snapshot_view_bullet_y(&view, b);
+    sink += acc;
+
+    return len;
+}
+
+static int encode_compressed(Codec_Context *ctx, const Game_State *state,
+                             unsigned char *buf)
+{
+    protocol_serialize_snapshot(state, PROTOCOL_VERSION, ctx->scratch);
+    return protocol_compress_snapshot(&ctx->encoder, ctx->scratch, buf);
+}
+
+static int decode_compressed(Codec_Context *ctx, const unsigned char *buf,
+                             size_t len, Game_State *state)
+{
+    int n = protocol_decompress_snapshot(&ctx->decoder, buf, len, ctx->scratch,
+                                         sizeof(ctx->scratch));
+    if (n < 0) return -1;
+    return protocol_deserialize_snapshot(ctx->scratch, n, PROTOCOL_VERSION,
+                                         state);
+}
+
+static const Codec codecs[] = {
+    {"legacy", encode_legacy, decode_legacy},
+    {"snapshot", encode_snapshot, decode_snapshot},
+    {"view", encode_snapshot, decode_view},
+    {"compressed", encode_compressed, decode_compressed},
+};
+
+#define CODECS_COUNT (sizeof(codecs) / sizeof(codecs[0]))
+
+/*
+ * THRESHOLDS
+ * ==========
+ * Upper bounds per codec and scenario, bytes are deterministic and checked
+ * as they are, times are per snapshot on an optimized build and get
+ * multiplied by the -s scale.
+ */
+typedef struct {
+    const char *codec;
+    const char *scenario;
+    double max_bytes;
+    double max_encode_ns;
+    double max_decode_ns;
+} Threshold;
+
+static const Threshold thresholds[] = {
+    {"legacy", "empty", 24, 150, 100},
+    {"legacy", "idle", 96, 150, 100},
+    {"legacy", "full", 210, 250, 250},
+    {"legacy", "bullet_heavy", 350, 400, 400},
+    {"snapshot", "empty", 37, 150, 100},
+    {"snapshot", "idle", 109, 150, 100},
+    {"snapshot", "full", 223, 250, 250},
+    {"snapshot", "bullet_heavy", 363, 400, 400},
+    {"view", "empty", 37, 150, 100},
+    {"view", "idle", 109, 150, 100},
+    {"view", "full", 223, 250, 250},
+    {"view", "bullet_heavy", 363, 400, 400},
+    {"compressed", "empty", 10, 300, 400},
+    {"compressed", "idle", 10, 1000, 800},
+    {"compressed", "full", 56, 2000, 2500},
+    {"compressed", "bullet_heavy", 14, 3000, 1500},
+};
+
+#define THRESHOLDS_COUNT (sizeof(thresholds) / sizeof(thresholds[0]))
+
+typedef struct {
+    double bytes;
+    double encode_ns;
+    double decode_ns;
+} Result;
+
+static int check_threshold(const char *codec, const char *scenario,
+                           const Result *result, double scale)
+{
+    for (size_t i = 0; i < THRESHOLDS_COUNT; ++i) {
+        const Threshold *t = &thresholds[i];
+        if (strcmp(t->codec, codec) != 0 || strcmp(t->scenario, scenario) != 0)
+            continue;
+
+        int failures = 0;
+        if (result->bytes > t->max_bytes) {
+            fprintf(stderr, "%s/%s: %.1f bytes per snapshot, limit %.1f\n",
+                    codec, scenario, result->bytes, t->max_bytes);
+            failures++;
+        }
+        if (result->encode_ns > t->max_encode_ns * scale) {
+            fprintf(stderr, "%s/%s: encode %.1f ns, limit %.1f\n", codec,
+                    scenario, result->encode_ns, t->max_encode_ns * scale);
+            failures++;
+        }
+        if (result->decode_ns > t->max_decode_ns * scale) {
+            fprintf(stderr, "%s/%s: decode %.1f ns, limit %.1f\n", codec,
+                    scenario, result->decode_ns, t->max_decode_ns * scale);
+            failures++;
+        }
+        return failures;
+    }
+
+    fprintf(stderr, "%s/%s: no threshold defined\n", codec, scenario);
+    return 1;
+}
+
+// Compares what the snapshot carries, the live entities and the power up
+static bool same_entities(const Game_State *a, const Game_State *b)
+{
+    if (a->power_up.kind != b->power_up.kind ||
+        a->power_up.x != b->power_up.x || a->power_up.y != b->power_up.y)
+        return false;
+
+    for (size_t i = 0; i < MAX_PLAYERS; ++i) {
+        const Tank *ta = &a->players[i], *tb = &b->players[i];
+        if (ta->alive != tb->alive) return false;
+        if (ta->alive && (ta->x != tb->x || ta->y != tb->y ||
+                          ta->hp != tb->hp || ta->direction != tb->direction))
+            return false;
+
+        for (size_t j = 0; j < MAX_AMMO; ++j) {
+            const Bullet *ba = &ta->bullet[j], *bb = &tb->bullet[j];
+            if (ba->active != bb->active) return false;
+            if (ba->active && (ba->x != bb->x || ba->y != bb->y ||
+                               ba->direction != bb->direction))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Runs a codec over a recorded match ROUNDS times, on the first round the
+ * decoded frames are checked against the recorded states.
+ */
+static int bench_codec(const Codec *codec, const Game_State *states,
+                       Result *result)
+{
+    static unsigned char frames[TICKS][BUFSIZE];
+    static int lengths[TICKS];
+    Codec_Context ctx;
+    Game_State decoded;
+    unsigned long long bytes = 0, encode_ns = 0, decode_ns = 0, start;
+
+    game_state_init(&decoded);
+    for (int r = 0; r < ROUNDS; ++r) {
+        compress_context_init(&ctx.encoder);
+        compress_context_init(&ctx.decoder);
+
+        start = get_nanoseconds_timestamp();
+        for (int t = 0; t < TICKS; ++t)
+            lengths[t] = codec->encode(&ctx, &states[t], frames[t]);
+        encode_ns += get_nanoseconds_timestamp() - start;
+
+        start = get_nanoseconds_timestamp();
+        for (int t = 0; t < TICKS; ++t) {
+            if (codec->decode(&ctx, frames[t], lengths[t], &decoded) < 0) {
+                fprintf(stderr, "%s: frame %d rejected\n", codec->name, t);
+                return -1;
+            }
+            if (r == 0 && codec->decode != decode_view &&
+                !same_entities(&decoded, &states[t])) {
+                fprintf(stderr, "%s: frame %d mismatch\n", codec->name, t);
+                return -1;
+            }
+        }
+        decode_ns += get_nanoseconds_timestamp() - start;
+    }
+
+    for (int t = 0; t < TICKS; ++t) bytes += lengths[t];
+
+    result->bytes     = (double)bytes / TICKS;
+    result->encode_ns = (double)encode_ns / ((double)TICKS * ROUNDS);
+    result->decode_ns = (double)decode_ns / ((double)TICKS * ROUNDS);
+    return 0;
+}
+
+/*
+ * I32 CODEC
+ * =========
+ * The byte swapping wire_write_i32 / snapshot_view_read_i32 the records go
+ * through against the reference bin_write_i32 / bin_read_i32.
+ */
+
+// Random 32 bit pattern, rand() alone only covers 31 bits
+static int random_i32(void)
+{
+    return (int)(((unsigned)rand() << 16) ^ (unsigned)rand());
+}
+
+// Cross-checks both codecs over the edge values then random ones, at every
+// alignment, the records put the I32 fields at odd offsets
+static int check_i32_codec(void)
+{
+    static const int edges[] = {0, 1, -1, 255, 256, INT_MAX, INT_MIN};
+    unsigned char ref[sizeof(int) + 3], wire[sizeof(int) + 3];
+
+    for (int round = 0; round < CODEC_SAMPLES; ++round) {
+        int val = round < (int)(sizeof(edges) / sizeof(edges[0]))
+                      ? edges[round]
+                      : random_i32();
+        size_t at = round % 4;
+        bin_write_i32(ref + at, val);
+        wire_write_i32(wire + at, val);
+
+        if (memcmp(ref + at, wire + at, sizeof(int)) != 0 ||
+            snapshot_view_read_i32(ref + at) != (int)bin_read_i32(ref + at)) {
+            fprintf(stderr, "i32 codec mismatch: %d at offset %zu\n", val, at);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// MB/s of the reference write, wire write, reference read and wire read
+static void bench_i32_codec(double *mbs)
+{
+    static int vals[CODEC_INTS], decoded[CODEC_INTS];
+    static unsigned char buf[CODEC_INTS * sizeof(int)];
+    unsigned long long start, ns[4];
+
+    for (size_t i = 0; i < CODEC_INTS; ++i) vals[i] = random_i32();
+
+    start = get_nanoseconds_timestamp();
+    for (int r = 0; r < CODEC_ROUNDS; ++r) {
+        for (size_t i = 0; i < CODEC_INTS; ++i)
+            bin_write_i32(buf + i * sizeof(int), vals[i]);
+        CLOBBER(buf);
+    }
+    ns[0] = get_nanoseconds_timestamp() - start;
+
+    start = get_nanoseconds_timestamp();
+    for (int r = 0; r < CODEC_ROUNDS; ++r) {
+        for (size_t i = 0; i < CODEC_INTS; ++i)
+            wire_write_i32(buf + i * sizeof(int), vals[i]);
+        CLOBBER(buf);
+    }
+    ns[1] = get_nanoseconds_timestamp() - start;
+
+    start = get_nanoseconds_timestamp();
+    for (int r = 0; r < CODEC_ROUNDS; ++r) {
+        for (size_t i = 0; i < CODEC_INTS; ++i)
+            decoded[i] = bin_read_i32(buf + i * sizeof(int));
+        CLOBBER(decoded);
+    }
+    ns[2] = get_nanoseconds_timestamp() - start;
+
+    start = get_nanoseconds_timestamp();
+    for (int r = 0; r < CODEC_ROUNDS; ++r) {
+        for (size_t i = 0; i < CODEC_INTS; ++i)
+            decoded[i] = snapshot_view_read_i32(buf + i * sizeof(int));
+        CLOBBER(decoded);
+    }
+    ns[3] = get_nanoseconds_timestamp() - start;
+
+    const double bytes = (double)sizeof(buf) * CODEC_ROUNDS;
+    for (int i = 0; i < 4; ++i) mbs[i] = bytes / ns[i] * 1e3;
+}
+
+int main(int argc, char **argv)
+{
+    static Game_State states[TICKS];
+    double scale = 1.0;
+    int failures = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-l") == 0) {
+            protocol_dump_layout(stdout);
+            return 0;
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            scale = atof(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [-l] [-s <time scale>]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    srand(42);
+    if (check_i32_codec() < 0) return EXIT_FAILURE;
+
+    printf("{\n  \"snapshots\": [");
+    for (size_t s = 0; s < SCENARIOS_COUNT; ++s) {
+        record_match(&scenarios[s], states);
+        for (size_t c = 0; c < CODECS_COUNT; ++c) {
+            Result result;
+            if (bench_codec(&codecs[c], states, &result) < 0)
+                return EXIT_FAILURE;
+
+            printf("%s\n    {\"codec\": \"%s\", \"scenario\": \"%s\", "
+                   "\"bytes\": %.1f, \"encode_ns\": %.1f, "
+                   "\"decode_ns\": %.1f}",
+                   s + c == 0 ? "" : ",", codecs[c].name, scenarios[s].name,
+                   result.bytes, result.encode_ns, result.decode_ns);
+
+            failures += check_threshold(codecs[c].name, scenarios[s].name,
+                                        &result, scale);
+        }
+    }
+
+    double mbs[4];
+    bench_i32_codec(mbs);
+    printf("\n  ],\n  \"i32\": {\"reference_write_mbs\": %.1f, "
+           "\"wire_write_mbs\": %.1f, \"reference_read_mbs\": %.1f, "
+           "\"wire_read_mbs\": %.1f},\n",
+           mbs[0], mbs[1], mbs[2], mbs[3]);
+    printf("  \"failures\": %d\n}\n", failures);
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -24,22 +24,59 @@
  * - the server will update the general game state and let it be broadcast in
  *   the following cycle
  */
-#include <arpa/inet.h>
-#include <netdb.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/ioctl.h>
+#include <unistd.h>
 
+#include "client_io.h"
+#include "client_session.h"
 #include "game_state.h"
-#include "network.h"
+#include "interpolation.h"
+#include "prediction.h"
 #include "protocol.h"
 #include "raylib.h"
 #include "sprite.h"
+#include "sprite_loader.h"
+#include "stats.h"
 
-#define BUFSIZE        2048
-#define CLIENT_TIMEOUT 10000
+// Send times of the last commands, to measure how long it takes for an input
+// to show up in a snapshot once the server acknowledges it
+#define SEQUENCE_HISTORY 64
+// Seconds between two summaries of the frame times on the overlay
+#define OVERLAY_REFRESH  0.5
 
 Sprite_Repo sprite_repo;
+// Stages the sprites in the background, they're drawn as placeholders until
+// it's done
+static Sprite_Loader sprite_loader;
+// Sprites of the frame being drawn, flushed once all are queued
+Sprite_Batch sprite_batch;
+// Sprites of the entities, resolved out of the repo once loaded, drawing a
+// frame only reads them
+static struct {
+    Sprite_Handle tanks[MAX_PLAYERS];
+    Sprite_Handle bullet;
+    Sprite_Handle power_up;
+} sprites;
+// Performance overlay, toggled with F3: frame times are measured here, the
+// network side comes summarized along with the snapshots
+static struct {
+    bool visible;
+    Stats_Ring frame_ms;
+    Stats_Summary frames;
+    double summarized_at;
+} overlay;
+// Process start, startup steps are timed from here
+static double started_at;
+
+// Reports how long after start `event` happened, once
+static void report_startup(bool *reported, const char *event)
+{
+    if (*reported) return;
+    *reported = true;
+    printf("[INFO] %s %.1f ms after start\n", event,
+           (client_io_now() - started_at) * 1000);
+}
 
 /*
  * RENDERING HELPERS
@@ -47,217 +84,337 @@ Sprite_Repo sprite_repo;
  * For the time being this represents the sole "graphic" layer, it's so small
  * it can comfortably live embedded in the client module.
  */
-static void render_tank(const Tank *const tank, size_t i)
+
+// Sprites missing from the repo, all of them until it's loaded, are drawn
+// as placeholders. Every player gets a ship of its own as long as there are
+// enough of them, they're reused in turn otherwise.
+static Sprite_Handle resolve_sprite(const Sprite_Repo *repo, Sprite_Kind kind,
+                                    size_t i)
 {
-    if (tank->alive) {
-        struct sprite tank_sprite;
-        sprite_repo_get(&sprite_repo, &tank_sprite, SPACESHIP, i);
-
-        float rotation = 0.0f;
-        switch (tank->direction) {
-            case DOWN:
-                rotation = 180.0f;
-                break;
-            case LEFT:
-                rotation = 270.0f;
-                break;
-            case RIGHT:
-                rotation = 90.0f;
-                break;
-            default:
-                break;
-        }
+    size_t count = repo->collections[kind].count;
+    if (count == 0) return sprite_placeholder(kind);
+    return sprite_repo_handle(repo, kind, i % count);
+}
+
+static void resolve_sprites(const Sprite_Repo *repo)
+{
+    for (size_t i = 0; i < MAX_PLAYERS; ++i)
+        sprites.tanks[i] = resolve_sprite(repo, SPACESHIP, i);
+    sprites.bullet   = resolve_sprite(repo, BULLET, 0);
+    sprites.power_up = resolve_sprite(repo, POWERUP, 0);
+}
+
+// Swaps the placeholders for the sprites once the loader is done, uploading
+// them takes a frame
+static void poll_sprites(void)
+{
+    static bool reported = false;
+    if (!sprite_loader_poll(&sprite_loader, &sprite_repo)) return;
+    resolve_sprites(&sprite_repo);
+    report_startup(&reported, "Sprites loaded");
+}
 
-        sprite_render_rotated(&tank_sprite, (float)tank->x, (float)tank->y,
-                              rotation);
+static void render_tank(float x, float y, Direction direction, size_t i)
+{
+    float rotation = 0.0f;
+    switch (direction) {
+        case DOWN:
+            rotation = 180.0f;
+            break;
+        case LEFT:
+            rotation = 270.0f;
+            break;
+        case RIGHT:
+            rotation = 90.0f;
+            break;
+        default:
+            break;
     }
+
+    sprite_batch_render_rotated(&sprite_batch, &sprites.tanks[i], x, y,
+                                rotation);
 }
 
-static void render_bullet(const Bullet *const bullet)
+static void render_bullet(float x, float y, Direction direction)
 {
-    if (bullet->active) {
-        // Draw the bullet at its current position, to do it
-        // we first load the texture from the repository
-        // TODO although the operation is pretty inexpensive as at this
-        // point it's just a lookup O(1) in an arraya we can probably
-        // attach the sprite directly to the tank and avoid this lookup
-        // altogether
-        struct sprite bullet_sprite;
-        sprite_repo_get(&sprite_repo, &bullet_sprite, BULLET, 0);
-
-        float rotation = 0.0f;
-        switch (bullet->direction) {
-            case DOWN:
-                rotation = 90.0f;
-                break;
-            case LEFT:
-                rotation = 180.0f;
-                break;
-            case UP:
-                rotation = 270.0f;
-                break;
-            default:
-                break;
-        }
-        sprite_render_rotated(&bullet_sprite, (float)bullet->x,
-                              (float)bullet->y, rotation);
+    float rotation = 0.0f;
+    switch (direction) {
+        case DOWN:
+            rotation = 90.0f;
+            break;
+        case LEFT:
+            rotation = 180.0f;
+            break;
+        case UP:
+            rotation = 270.0f;
+            break;
+        default:
+            break;
     }
+    sprite_batch_render_rotated(&sprite_batch, &sprites.bullet, x, y,
+                                rotation);
 }
 
-static void render_power_up(const Game_State *state)
+static void render_power_up(const Snapshot_View *view)
 {
-    if (state->power_up.kind == NONE) return;
+    Power_Up kind = snapshot_view_power_up_kind(view);
+    if (kind == NONE) return;
 
-    struct sprite powerup_sprite;
-    sprite_repo_get(&sprite_repo, &powerup_sprite, POWERUP, 0);
+    int x = snapshot_view_power_up_x(view), y = snapshot_view_power_up_y(view);
 
-    switch (state->power_up.kind) {
+    switch (kind) {
         case HP_PLUS_ONE:
-            sprite_render(&powerup_sprite, state->power_up.x, state->power_up.y,
-                          YELLOW);
+            sprite_batch_render(&sprite_batch, &sprites.power_up, x, y,
+                                YELLOW);
             break;
         case HP_PLUS_THREE:
-            sprite_render(&powerup_sprite, state->power_up.x, state->power_up.y,
-                          DARKGREEN);
+            sprite_batch_render(&sprite_batch, &sprites.power_up, x, y,
+                                DARKGREEN);
             break;
         case AMMO_PLUS_ONE:
-            sprite_render(&powerup_sprite, state->power_up.x, state->power_up.y,
-                          DARKBLUE);
+            sprite_batch_render(&sprite_batch, &sprites.power_up, x, y,
+                                DARKBLUE);
             break;
         default:
             break;
     }
 }
 
-static void render_stats(const Game_State *state, size_t index)
+// Bullets not in flight are the ones still available to the player
+static int view_ammo(const Snapshot_View *view, size_t index)
 {
-    int bullet_count = game_state_ammo(state, index);
-    DrawText(TextFormat("X: %d Y: %d", state->players[index].x,
-                        state->players[index].y),
-             1, 1, 10, DARKBLUE);
-    DrawText(TextFormat("HP: %d", state->players[index].hp), 1, 12, 10,
-             DARKBLUE);
-
-    DrawText(TextFormat("AMMO: %d", bullet_count), 1, 24, 10, DARKBLUE);
+    int count = MAX_AMMO;
+    for (size_t i = 0; i < view->bullets_count; ++i)
+        if (snapshot_view_bullet_owner(view, i) == index) count--;
+    return count;
 }
 
-static void render_game(const Game_State *state, size_t index)
+// Input latency is negative until the first ack arrives, draw calls are the
+// ones of the sprites, the text goes in one more
+static void render_stats(const Snapshot_View *view, size_t index, int ammo,
+                         int latency_ms, const Sprite_Batch *batch)
 {
-    BeginDrawing();
-    ClearBackground(BLACK);
-    for (size_t i = 0; i < state->active_players; ++i) {
-        render_tank(&state->players[i], i);
-        for (size_t j = 0; j < MAX_AMMO; ++j)
-            render_bullet(&state->players[i].bullet[j]);
+    for (size_t i = 0; i < view->tanks_count; ++i) {
+        if (snapshot_view_tank_id(view, i) != index) continue;
+        DrawText(TextFormat("X: %d Y: %d", snapshot_view_tank_x(view, i),
+                            snapshot_view_tank_y(view, i)),
+                 1, 1, 10, DARKBLUE);
+        DrawText(TextFormat("HP: %d", snapshot_view_tank_hp(view, i)), 1, 12,
+                 10, DARKBLUE);
+        break;
     }
 
-    render_power_up(state);
-    render_stats(state, index);
-
-    EndDrawing();
+    DrawText(TextFormat("AMMO: %d", ammo), 1, 24, 10, DARKBLUE);
+    if (latency_ms >= 0)
+        DrawText(TextFormat("INPUT: %d ms", latency_ms), 1, 36, 10, DARKBLUE);
+    DrawText(TextFormat("DRAW CALLS: %d (%d sprites)", batch->draw_calls,
+                        batch->quads),
+             1, 48, 10, DARKBLUE);
 }
 
-/*
- * NETWORK HELPERS
- * ===============
- * Just some connection and read/write throught the wire helpers
- */
-static int socket_connect(const char *host, int port)
+// Draws the live entities straight out of the received frame
+static void render_view_entities(const Snapshot_View *view, size_t index,
+                                 const Tank *predicted)
 {
-    int s, retval = -1;
-    struct addrinfo *servinfo, *p;
-    struct timeval tv           = {0, CLIENT_TIMEOUT};
-    const struct addrinfo hints = {.ai_family   = AF_UNSPEC,
-                                   .ai_socktype = SOCK_STREAM,
-                                   .ai_flags    = AI_PASSIVE};
-
-    char port_string[6];
-    snprintf(port_string, sizeof(port_string), "%d", port);
-
-    if (getaddrinfo(host, port_string, &hints, &servinfo) != 0) return -1;
-
-    for (p = servinfo; p != NULL; p = p->ai_next) {
-        /* Try to create the socket and to connect it.
-         * If we fail in the socket() call, or on connect(), we retry with
-         * the next entry in servinfo. */
-        if ((s = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1)
-            continue;
+    for (size_t i = 0; i < view->tanks_count; ++i) {
+        size_t id = snapshot_view_tank_id(view, i);
+        if (id == index && predicted)
+            render_tank(predicted->x, predicted->y, predicted->direction, id);
+        else
+            render_tank(snapshot_view_tank_x(view, i),
+                        snapshot_view_tank_y(view, i),
+                        snapshot_view_tank_direction(view, i), id);
+    }
 
-        setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(struct timeval));
-        setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(struct timeval));
+    for (size_t i = 0; i < view->bullets_count; ++i)
+        render_bullet(snapshot_view_bullet_x(view, i),
+                      snapshot_view_bullet_y(view, i),
+                      snapshot_view_bullet_direction(view, i));
+}
 
-        /* Try to connect. */
-        if (connect(s, p->ai_addr, p->ai_addrlen) == -1) {
-            close(s);
-            break;
+// Draws the entities where the interpolation puts them
+static void render_world_entities(const Interpolated_State *world,
+                                  size_t index, const Tank *predicted)
+{
+    for (size_t i = 0; i < MAX_PLAYERS; ++i) {
+        const Tank *tank = &world->state.players[i];
+        if (i == index && predicted)
+            render_tank(predicted->x, predicted->y, predicted->direction, i);
+        else if (tank->alive)
+            render_tank(world->tank_x[i], world->tank_y[i], tank->direction,
+                        i);
+
+        for (size_t j = 0; j < MAX_AMMO; ++j) {
+            if (!tank->bullet[j].active) continue;
+            render_bullet(world->bullet_x[i * MAX_AMMO + j],
+                          world->bullet_y[i * MAX_AMMO + j],
+                          tank->bullet[j].direction);
         }
-
-        /* If we ended an iteration of the for loop without errors, we
-         * have a connected socket. Let's return to the caller. */
-        retval = s;
-        break;
     }
+}
 
-    freeaddrinfo(servinfo);
-    return retval; /* Will be -1 if no connection succeeded. */
-
-err:
+// Records the last frame time, the percentiles are only worked out every
+// OVERLAY_REFRESH while the overlay is shown
+static void update_overlay(void)
+{
+    if (IsKeyPressed(KEY_F3)) overlay.visible = !overlay.visible;
+    stats_ring_push(&overlay.frame_ms, GetFrameTime() * 1000);
+    double now = client_io_now();
+    if (!overlay.visible || now - overlay.summarized_at < OVERLAY_REFRESH)
+        return;
+    stats_ring_summarize(&overlay.frame_ms, &overlay.frames);
+    overlay.summarized_at = now;
+}
 
-    close(s);
-    perror("socket(2) opening socket failed");
-    return -1;
+// Below the stats, the round trip is unknown to servers not answering pings
+static void render_overlay(const Net_Summary *net)
+{
+    const Stats_Summary *frames = &overlay.frames;
+    DrawText(TextFormat("FRAME: p50 %.1f p95 %.1f p99 %.1f max %.1f ms",
+                        frames->p50, frames->p95, frames->p99, frames->max),
+             1, 66, 10, DARKBLUE);
+    DrawText(TextFormat("SNAPSHOTS: every %.1f ms, jitter %.1f ms",
+                        net->arrivals.mean, net->arrivals.stddev),
+             1, 78, 10, DARKBLUE);
+    DrawText(TextFormat("DECODE: p50 %.0f p99 %.0f us", net->decode.p50,
+                        net->decode.p99),
+             1, 90, 10, DARKBLUE);
+    DrawText(TextFormat("NET: in %.1f out %.1f KB/s", net->bytes_in / 1024,
+                        net->bytes_out / 1024),
+             1, 102, 10, DARKBLUE);
+    if (net->rtt.count > 0)
+        DrawText(TextFormat("RTT: p50 %.1f max %.1f ms", net->rtt.p50,
+                            net->rtt.max),
+                 1, 114, 10, DARKBLUE);
+    else
+        DrawText("RTT: n/a", 1, 114, 10, DARKBLUE);
 }
 
-static int client_connect(const char *host, int port)
+/*
+ * Draws the battlefield, the entities interpolated if `world` is given,
+ * as of the last snapshot otherwise, the player tank where the prediction
+ * puts it if there's one. Stats always come from the last snapshot.
+ */
+static void render_game(const Snapshot_View *view, size_t index, int ammo,
+                        int latency_ms, const Tank *predicted,
+                        const Interpolated_State *world,
+                        const Net_Summary *net)
 {
-    return socket_connect(host, port);
+    static bool in_match = false;
+    BeginDrawing();
+    ClearBackground(BLACK);
+    sprite_batch_begin(&sprite_batch);
+    if (world)
+        render_world_entities(world, index, predicted);
+    else
+        render_view_entities(view, index, predicted);
+
+    render_power_up(view);
+    sprite_batch_flush(&sprite_batch);
+    render_stats(view, index, ammo, latency_ms, &sprite_batch);
+    if (overlay.visible) render_overlay(net);
+
+    EndDrawing();
+    report_startup(&in_match, "In the match");
 }
 
-static int client_send_data(int sockfd, const unsigned char *data,
-                            size_t datasize)
+// Directions held down and fire, as an edge, if there's ammo left
+static unsigned read_input(int ammo)
 {
-    ssize_t n = network_send(sockfd, data, datasize);
-    if (n < 0) {
-        perror("write() error");
-        close(sockfd);
-        exit(EXIT_FAILURE);
-    }
-    return n;
+    unsigned input = 0;
+    if (IsKeyDown(KEY_UP)) input |= INPUT_UP;
+    if (IsKeyDown(KEY_DOWN)) input |= INPUT_DOWN;
+    if (IsKeyDown(KEY_LEFT)) input |= INPUT_LEFT;
+    if (IsKeyDown(KEY_RIGHT)) input |= INPUT_RIGHT;
+    if (IsKeyPressed(KEY_SPACE) && ammo > 0) input |= INPUT_FIRE;
+    return input;
 }
 
-static int client_recv_data(int sockfd, unsigned char *data)
+// Rewinds the predicted tank to the one in the snapshot and replays the
+// commands not acknowledged yet
+static void reconcile(Prediction *prediction, const Snapshot_View *view,
+                      size_t index)
 {
-    ssize_t n = network_recv(sockfd, data);
-    if (n < 0) {
-        perror("read() error");
-        close(sockfd);
-        exit(EXIT_FAILURE);
+    for (size_t i = 0; i < view->tanks_count; ++i) {
+        if (snapshot_view_tank_id(view, i) != index) continue;
+        Tank server;
+        snapshot_view_tank(view, i, &server);
+        prediction_reconcile(prediction, &server, view->ack, view->ack_ticks);
+        return;
     }
-    return n;
+    prediction_invalidate(prediction);
 }
 
-// Main game loop, capture input from the player and communicate with the game
-// server
-static void game_loop(void)
+// Main game loop, capture input from the player and hand it to the I/O
+// thread, draw the latest state it received at every frame
+static void game_loop(unsigned caps)
 {
-    int sockfd = client_connect("127.0.0.1", 6699);
+    int sockfd = client_session_connect("127.0.0.1", 6699);
     if (sockfd < 0) exit(EXIT_FAILURE);
-    Game_State state;
-    game_state_init(&state);
-    unsigned char buf[BUFSIZE];
+    const Client_Snapshot *snapshot = NULL, *fresh = NULL;
+    Client_IO io;
+    Interpolation interpolation;
+    Interpolated_State world;
+    Hello session;
+    double sent_at[SEQUENCE_HISTORY];
+    Prediction prediction;
     // Sync the game state for the first time
-    int n = client_recv_data(sockfd, buf);
-    protocol_deserialize_game_state(buf, &state);
-    size_t index              = state.player_index;
+    if (client_session_handshake(sockfd, caps, &session) < 0) {
+        perror("client_session_handshake() error");
+        close(sockfd);
+        exit(EXIT_FAILURE);
+    }
+    if (client_io_start(&io, sockfd, &session) < 0) {
+        perror("client_io_start() error");
+        close(sockfd);
+        exit(EXIT_FAILURE);
+    }
+    bool held_input           = session.caps & CAP_INPUT;
+    // Acks are needed to know which commands to replay
+    bool predict              = session.version >= PROTOCOL_VERSION_SEQUENCED;
+    // So is the server tick to interpolate
+    bool interpolate          = session.version >= PROTOCOL_VERSION_SEQUENCED;
+    size_t index              = session.player_index;
+    int ammo                  = MAX_AMMO;
     unsigned action           = IDLE;
+    unsigned input            = 0;
+    uint32_t sequence         = 0, ack = 0;
+    // Tick of what's on screen, reported with the commands so the server
+    // checks the fires against it
+    uint32_t view_tick        = 0;
+    int latency_ms            = -1;
     bool is_direction         = false;
     bool can_fire             = false;
     float key_cooldown        = 0.02f;  // 200 ms between keypresses
     float last_key_press_time = 0.0f;
+    double next_tick          = GetTime();
+    bool first_frame          = false;
 
-    while (!WindowShouldClose()) {
+    prediction_init(&prediction, index);
+    interpolation_init(&interpolation);
+
+    while (!WindowShouldClose() && !client_io_closed(&io)) {
         float current_time = GetTime();
-        if (current_time - last_key_press_time > key_cooldown) {
+        poll_sprites();
+        update_overlay();
+        if (held_input) {
+            // The server applies the input every tick, only changes need to
+            // go through the wire, a change not queued is retried next frame
+            unsigned current = read_input(ammo);
+            Client_Command command = {CLIENT_COMMAND_INPUT, current,
+                                      sequence + 1, view_tick};
+            if (current != input && client_io_send(&io, &command)) {
+                input                                  = current;
+                sent_at[++sequence % SEQUENCE_HISTORY] = client_io_now();
+            }
+            // Held input moves the tank once per server tick, so does the
+            // prediction; after a stall it resumes instead of catching up
+            if (current_time - next_tick > 0.25) next_tick = current_time;
+            for (; predict && next_tick <= current_time;
+                 next_tick += TICK_US / 1e6)
+                prediction_push(&prediction, sequence,
+                                game_state_input_direction(input));
+        } else if (current_time - last_key_press_time > key_cooldown) {
             action = IDLE;
             if (IsKeyDown(KEY_RIGHT)) {
                 action              = RIGHT;
@@ -279,33 +436,79 @@ static void game_loop(void)
 
             is_direction = (action == UP || action == DOWN || action == LEFT ||
                             action == RIGHT);
-            can_fire = (action == FIRE && game_state_ammo(&state, index) > 0);
-            if (is_direction || can_fire) {
-                memset(buf, 0x00, sizeof(buf));
-                n = protocol_serialize_action(action, buf);
-                client_send_data(sockfd, buf, n);
+            can_fire     = (action == FIRE && ammo > 0);
+            Client_Command command = {CLIENT_COMMAND_ACTION, action,
+                                      sequence + 1, view_tick};
+            if ((is_direction || can_fire) && client_io_send(&io, &command)) {
+                sent_at[++sequence % SEQUENCE_HISTORY] = client_io_now();
+                if (predict) prediction_push(&prediction, sequence, action);
             }
         }
-        n = client_recv_data(sockfd, buf);
-        // render the battlefield and the tanks only when some payload is
-        // actually received
-        if (n > (int)sizeof(int)) {
-            protocol_deserialize_game_state(buf, &state);
-            render_game(&state, index);
+
+        // Whatever arrived since the last frame, already decoded by the I/O
+        // thread; a frame is drawn either way
+        if ((fresh = client_io_latest(&io))) {
+            snapshot = fresh;
+            const Snapshot_View *view = &snapshot->view;
+            if (view->ack > ack) {
+                if (sequence - view->ack < SEQUENCE_HISTORY)
+                    latency_ms = (snapshot->received_at -
+                                  sent_at[view->ack % SEQUENCE_HISTORY]) *
+                                 1000;
+                ack = view->ack;
+            }
+            if (predict) reconcile(&prediction, view, index);
+            if (interpolate)
+                interpolation_push(&interpolation, view->tick, &snapshot->state,
+                                   &snapshot->entities, snapshot->received_at);
+        }
+        if (!snapshot) {
+            // Nothing to draw yet, keep the window responsive meanwhile
+            BeginDrawing();
+            ClearBackground(BLACK);
+            EndDrawing();
+            report_startup(&first_frame, "First frame");
+            continue;
         }
+
+        ammo = view_ammo(&snapshot->view, index);
+        bool interpolated = interpolate && interpolation_sample(
+                                               &interpolation, client_io_now(),
+                                               &world);
+        view_tick = interpolated ? world.state.tick : snapshot->view.tick;
+        render_game(&snapshot->view, index, ammo, latency_ms,
+                    prediction_tank(&prediction),
+                    interpolated ? &world : NULL, &snapshot->net);
     }
+
+    client_io_stop(&io);
+    close(sockfd);
 }
 
-int main(void)
+int main(int argc, char **argv)
 {
+    // Snapshot compression is opt-in, it trades a little CPU on both ends
+    // for bandwidth
+    unsigned caps = PROTOCOL_CAPS & ~CAP_COMPRESS;
+    for (int i = 1; i < argc; ++i)
+        if (strcmp(argv[i], "-z") == 0) caps |= CAP_COMPRESS;
+
+    started_at = client_io_now();
     InitWindow(SCREEN_WIDTH, SCREEN_HEIGHT,
                "raylib battletank (or spacebattle)");
 
-    sprite_repo_load(&sprite_repo);
+    // The sprites load while connecting and syncing, placeholders meanwhile
+    resolve_sprites(&sprite_repo);
+    if (sprite_loader_start(&sprite_loader) < 0) {
+        sprite_repo_load(&sprite_repo);
+        resolve_sprites(&sprite_repo);
+    }
 
     SetTargetFPS(120);
-    game_loop();
+    game_loop(caps);
 
+    // Closed before the sprites were done loading, they're freed all the same
+    sprite_loader_wait(&sprite_loader, &sprite_repo);
     sprite_repo_free(&sprite_repo);
 
     CloseWindow();  // Close window and OpenGL context
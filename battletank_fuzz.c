@@ -0,0 +1,422 @@
+/*
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                    Version 2, December 2004
+ *
+ * Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ * Everyone is permitted to copy and distribute verbatim or modified
+ * copies of this license document, and changing it is allowed as long
+ * as the name is changed.
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *   TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *  0. You just DO WHAT THE FUCK YOU WANT TO.
+ *
+ * Fuzz harness of the protocol decoders, everything that parses bytes coming
+ * off a socket.
+ *
+ * Every input is a frame as received, it's run through each decoder for each
+ * protocol version: snapshot views and snapshots, actions, inputs, hellos,
+ * pings and pongs, entity events and compressed snapshots. Beyond surviving
+ * the input, a frame a decoder takes must encode back to the same bytes, and
+ * a snapshot the view takes must decode as well.
+ *
+ * Built with BUILD=fuzz (clang) it's a libFuzzer target, otherwise it
+ * replays files, with sanitizers in the debug build, and can mutate them on
+ * its own for a crude fuzzing run where libFuzzer isn't available. AFL and
+ * the like can drive it through a file or stdin.
+ *
+ * Usage: battletank-fuzz [-g <dir>] [-m <mutations>] [-s <seed>] [file|dir...]
+ *
+ * -g  write the seed corpus, valid frames of every kind and version, to dir
+ * -m  also run this many random mutations of every input
+ * -s  seed of the mutations
+ *
+ * With no file nor dir the input is read from stdin.
+ */
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "game_state.h"
+#include "protocol.h"
+
+#define BUFSIZE    2048
+// Inputs longer than this are cut, way above any frame the peers accept
+#define INPUT_SIZE (BUFSIZE * 2)
+
+// Keeps the compiler from optimizing away the decoded values
+static volatile long sink;
+
+// Crashes on purpose, the fuzzer keeps the input that got there
+static void broken(const char *what, unsigned version)
+{
+    fprintf(stderr, "[ERROR] %s, version %u\n", what, version);
+    abort();
+}
+
+static void fuzz_snapshot(const unsigned char *data, size_t size,
+                          unsigned version)
+{
+    Snapshot_View view;
+    Game_State state;
+
+    if (protocol_snapshot_view(data, size, version, &view) < 0) return;
+
+    // Every byte the accessors touch must be within the frame
+    long acc = view.ack + view.ack_ticks + view.tick +
+               snapshot_view_player_index(&view) +
+               snapshot_view_power_up_x(&view) +
+               snapshot_view_power_up_kind(&view);
+    for (size_t i = 0; i < view.tanks_count; ++i) {
+        Tank tank;
+        snapshot_view_tank(&view, i, &tank);
+        acc += snapshot_view_tank_id(&view, i) + tank.x + tank.y + tank.hp;
+    }
+    for (size_t i = 0; i < view.bullets_count; ++i)
+        acc += snapshot_view_bullet_owner(&view, i) +
+               snapshot_view_bullet_x(&view, i) +
+               snapshot_view_bullet_direction(&view, i);
+    sink += acc;
+
+    game_state_init(&state);
+    if (protocol_deserialize_snapshot(data, size, version, &state) !=
+        (int)size)
+        broken("snapshot viewed but not decoded", version);
+}
+
+static void fuzz_commands(const unsigned char *data, size_t size,
+                          unsigned version)
+{
+    unsigned char buf[BUFSIZE];
+    unsigned value;
+    uint32_t sequence, tick;
+
+    if (protocol_deserialize_action_message(data, size, version, &value,
+                                            &sequence, &tick) >= 0) {
+        int n = protocol_serialize_action_message(value, version, sequence,
+                                                  tick, buf);
+        if ((size_t)n != size || memcmp(buf, data, size) != 0)
+            broken("action message doesn't encode back", version);
+    }
+
+    if (protocol_deserialize_input(data, size, version, &value, &sequence,
+                                   &tick) >= 0) {
+        int n = protocol_serialize_input(value, version, sequence, tick, buf);
+        if ((size_t)n != size || memcmp(buf, data, size) != 0)
+            broken("input doesn't encode back", version);
+    }
+}
+
+// Frames whose layout doesn't depend on the version
+static void fuzz_messages(const unsigned char *data, size_t size)
+{
+    unsigned char buf[BUFSIZE];
+    Entity_Event events[ENTITY_EVENTS_MAX];
+    size_t count;
+    unsigned action;
+    uint32_t stamp;
+    Hello hello;
+
+    if (protocol_deserialize_action(data, size, &action) >= 0) {
+        int n = protocol_serialize_action(action, buf);
+        if ((size_t)n != size || memcmp(buf, data, size) != 0)
+            broken("action doesn't encode back", PROTOCOL_VERSION_LEGACY);
+    }
+
+    if (protocol_deserialize_hello(data, size, &hello) >= 0) {
+        int n = protocol_serialize_hello(&hello, buf);
+        if ((size_t)n != size || memcmp(buf, data, size) != 0)
+            broken("hello doesn't encode back", hello.version);
+    }
+
+    for (Message_Type type = MSG_PING; type <= MSG_PONG; ++type) {
+        if (protocol_deserialize_ping(data, size, type, &stamp) < 0) continue;
+        int n = protocol_serialize_ping(type, stamp, buf);
+        if ((size_t)n != size || memcmp(buf, data, size) != 0)
+            broken("ping doesn't encode back", PROTOCOL_VERSION_TYPED);
+    }
+
+    if (protocol_deserialize_entity_events(data, size, events, &count) >= 0) {
+        int n = protocol_serialize_entity_events(events, count, buf);
+        if ((size_t)n != size || memcmp(buf, data, size) != 0)
+            broken("entity events don't encode back", PROTOCOL_VERSION_TYPED);
+    }
+}
+
+/*
+ * Compressed snapshots are decoded twice in a row on the same context, the
+ * second time against the history left by the first one, as the second
+ * snapshot of a connection would be.
+ */
+static void fuzz_compressed(const unsigned char *data, size_t size)
+{
+    unsigned char buf[BUFSIZE];
+    Compress_Context ctx;
+
+    compress_context_init(&ctx);
+    for (int pass = 0; pass < 2; ++pass) {
+        int n = protocol_decompress_snapshot(&ctx, data, size, buf,
+                                             sizeof(buf));
+        if (n < 0) return;
+        if ((size_t)n > sizeof(buf))
+            broken("compressed snapshot overflows", PROTOCOL_VERSION_TYPED);
+        for (unsigned version = PROTOCOL_VERSION_TYPED;
+             version <= PROTOCOL_VERSION; ++version)
+            fuzz_snapshot(buf, n, version);
+    }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    for (unsigned version = PROTOCOL_VERSION_LEGACY;
+         version <= PROTOCOL_VERSION; ++version) {
+        fuzz_snapshot(data, size, version);
+        fuzz_commands(data, size, version);
+    }
+    fuzz_messages(data, size);
+    fuzz_compressed(data, size);
+    return 0;
+}
+
+#ifndef FUZZ_LIBFUZZER
+
+/*
+ * SEED CORPUS
+ * ===========
+ * A valid frame of every kind for every version it exists in, taken from a
+ * few ticks of a match with bullets in flight and a power-up on the field.
+ */
+static int write_frame(const char *dir, const char *name,
+                       const unsigned char *buf, int len)
+{
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+    FILE *fp = fopen(path, "wb");
+    if (!fp) {
+        perror(path);
+        return -1;
+    }
+    int err = fwrite(buf, 1, len, fp) == (size_t)len ? 0 : -1;
+    if (fclose(fp) != 0) err = -1;
+    if (err < 0) perror(path);
+    return err;
+}
+
+static int write_corpus(const char *dir)
+{
+    unsigned char buf[BUFSIZE], frame[BUFSIZE];
+    char name[64];
+    Game_State state;
+    Entity_Table empty, table;
+    Entity_Event events[ENTITY_EVENTS_MAX];
+    Compress_Context ctx;
+    int err = 0;
+
+    srand(42);
+    game_state_init(&state);
+    game_state_entities(&state, &empty);
+    for (size_t i = 0; i < 3; ++i) game_state_spawn_tank(&state, i);
+    game_state_generate_power_up(&state);
+    game_state_update_tank(&state, 0, FIRE);
+    game_state_update_tank(&state, 1, FIRE);
+    game_state_update_tank(&state, 2, LEFT);
+    for (int t = 0; t < 4; ++t) game_state_update(&state);
+    game_state_entities(&state, &table);
+
+    mkdir(dir, 0755);
+
+    int n = protocol_serialize_game_state(&state, buf);
+    err |= write_frame(dir, "v1-snapshot", buf, n);
+    n = protocol_serialize_action(FIRE, buf);
+    err |= write_frame(dir, "v1-action", buf, n);
+
+    for (unsigned version = PROTOCOL_VERSION_TYPED;
+         version <= PROTOCOL_VERSION; ++version) {
+        Hello hello = {version, PROTOCOL_CAPS, 1};
+
+        n = protocol_serialize_snapshot(&state, version, frame);
+        snprintf(name, sizeof(name), "v%u-snapshot", version);
+        err |= write_frame(dir, name, frame, n);
+
+        compress_context_init(&ctx);
+        n = protocol_compress_snapshot(&ctx, frame, buf);
+        snprintf(name, sizeof(name), "v%u-compressed", version);
+        err |= write_frame(dir, name, buf, n);
+
+        n = protocol_serialize_action_message(FIRE, version, 7, 120, buf);
+        snprintf(name, sizeof(name), "v%u-action", version);
+        err |= write_frame(dir, name, buf, n);
+
+        n = protocol_serialize_input(INPUT_UP | INPUT_FIRE, version, 8, 121,
+                                     buf);
+        snprintf(name, sizeof(name), "v%u-input", version);
+        err |= write_frame(dir, name, buf, n);
+
+        n = protocol_serialize_hello(&hello, buf);
+        snprintf(name, sizeof(name), "v%u-hello", version);
+        err |= write_frame(dir, name, buf, n);
+    }
+
+    n = protocol_serialize_ping(MSG_PING, 123456, buf);
+    err |= write_frame(dir, "ping", buf, n);
+    n = protocol_serialize_ping(MSG_PONG, 123456, buf);
+    err |= write_frame(dir, "pong", buf, n);
+
+    size_t count = entity_table_diff(&empty, &table, events);
+    n            = protocol_serialize_entity_events(events, count, buf);
+    err |= write_frame(dir, "entity-events", buf, n);
+
+    return err;
+}
+
+/*
+ * REPLAY
+ * ======
+ * Inputs are copied to a buffer of their exact size, so that the sanitizers
+ * catch a read a single byte past them.
+ */
+static size_t inputs, runs;
+
+static void run(const unsigned char *data, size_t size)
+{
+    unsigned char *copy = malloc(size ? size : 1);
+    if (!copy) abort();
+    memcpy(copy, data, size);
+    LLVMFuzzerTestOneInput(copy, size);
+    free(copy);
+    runs++;
+}
+
+// Byte flips, interesting values, truncation and growth, a few at a time
+static size_t mutate(unsigned char *buf, size_t size)
+{
+    static const unsigned char interesting[] = {0x00, 0x01, 0x7f,
+                                                0x80, 0xff, MSG_PONG + 1};
+    int count = 1 + rand() % 4;
+
+    for (int i = 0; i < count; ++i) {
+        size_t at = size ? (size_t)rand() % size : 0;
+        switch (rand() % 5) {
+        case 0:
+            if (size) buf[at] ^= 1 << (rand() % 8);
+            break;
+        case 1:
+            if (size) buf[at] = interesting[rand() % sizeof(interesting)];
+            break;
+        case 2:
+            if (size) buf[at] = rand();
+            break;
+        case 3:
+            size = at;
+            break;
+        case 4:
+            if (size < INPUT_SIZE) buf[size++] = rand();
+            break;
+        }
+    }
+    return size;
+}
+
+static void replay(const unsigned char *data, size_t size,
+                   unsigned long mutations)
+{
+    unsigned char buf[INPUT_SIZE];
+
+    inputs++;
+    run(data, size);
+    for (unsigned long i = 0; i < mutations; ++i) {
+        memcpy(buf, data, size);
+        run(buf, mutate(buf, size));
+    }
+}
+
+static int replay_file(const char *path, unsigned long mutations)
+{
+    unsigned char data[INPUT_SIZE];
+
+    FILE *fp = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+    if (!fp) {
+        perror(path);
+        return -1;
+    }
+    size_t size = fread(data, 1, sizeof(data), fp);
+    int err     = ferror(fp) ? -1 : 0;
+    if (fp != stdin) fclose(fp);
+    if (err < 0) {
+        perror(path);
+        return -1;
+    }
+
+    replay(data, size, mutations);
+    return 0;
+}
+
+static int replay_path(const char *path, unsigned long mutations)
+{
+    struct stat st;
+    char file[1024];
+    int err = 0;
+
+    if (strcmp(path, "-") == 0 || stat(path, &st) < 0 || !S_ISDIR(st.st_mode))
+        return replay_file(path, mutations);
+
+    DIR *dir = opendir(path);
+    if (!dir) {
+        perror(path);
+        return -1;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        if (entry->d_name[0] == '.') continue;
+        snprintf(file, sizeof(file), "%s/%s", path, entry->d_name);
+        err |= replay_file(file, mutations);
+    }
+    closedir(dir);
+    return err;
+}
+
+int main(int argc, char **argv)
+{
+    const char *corpus      = NULL;
+    unsigned long mutations = 0;
+    unsigned seed           = 1;
+    int opt, err = 0;
+
+    while ((opt = getopt(argc, argv, "g:m:s:")) != -1) {
+        switch (opt) {
+        case 'g':
+            corpus = optarg;
+            break;
+        case 'm':
+            mutations = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            seed = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr,
+                    "usage: %s [-g corpus dir] [-m mutations] [-s seed] "
+                    "[file|dir...]\n",
+                    argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (corpus) return write_corpus(corpus) < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+
+    srand(seed);
+    if (optind == argc) err = replay_path("-", mutations);
+    for (int i = optind; i < argc; ++i) err |= replay_path(argv[i], mutations);
+
+    fprintf(stderr, "[INFO] %zu inputs, %zu runs\n", inputs, runs);
+    return err < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#endif
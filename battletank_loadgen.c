@@ -0,0 +1,616 @@
+/*
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                    Version 2, December 2004
+ *
+ * Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ * Everyone is permitted to copy and distribute verbatim or modified
+ * copies of this license document, and changing it is allowed as long
+ * as the name is changed.
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *   TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *  0. You just DO WHAT THE FUCK YOU WANT TO.
+ *
+ * Load generator, a swarm of scripted bots to capacity test the server.
+ *
+ * Every bot is a full protocol client built on the headless client session,
+ * with its own connection, handshake, compression history and entity table,
+ * all of them driven by a single epoll loop. Bots connect at a steady rate,
+ * then play an input pattern until the end of the run:
+ *
+ * - idle    connect and only listen to the snapshots
+ * - random  a random direction or none at every step, firing now and then
+ * - circle  up, right, down and left in turn
+ * - fire    fire at every other step, standing still
+ * - stall   stop reading once playing, with a small receive buffer, to check
+ *           that the server drops a player it can't write a whole snapshot
+ *           to, reported as dropped
+ *
+ * Observed by the bots: the server tick interval (time between snapshots
+ * divided by the ticks they advance), the input latency (a command sent to
+ * the first snapshot acknowledging it), the snapshot age (time since the
+ * last snapshot arrived, sampled at every step, how stale the world a
+ * player acts on is), the ping round trip and the handshake time, plus the
+ * throughput both ways. Progress goes to stderr
+ * every second, the report is printed as JSON on stdout at the end.
+ *
+ * The server seats MAX_PLAYERS players, connections past that are closed
+ * right away and reported as rejected, so the rest measure how it copes
+ * with a crowd knocking at the door.
+ *
+ * Usage: battletank-loadgen [-h host] [-p port] [-n bots] [-r connects/s]
+ *                           [-d seconds] [-m pattern] [-i step ms] [-z]
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "client_session.h"
+#include "network.h"
+#include "protocol.h"
+
+#define LOADGEN_EVENTS    256
+// Longest epoll wait, steps and connects are checked at least this often
+#define LOADGEN_WAIT_MS   5
+// Seconds between two pings of a bot
+#define LOADGEN_PING      1.0
+#define SEQUENCE_HISTORY  64
+// Receive buffer of a stalling bot, the kernel doubles it
+#define LOADGEN_STALL_RCVBUF 1024
+// 0.1 ms buckets up to 1 s, slower samples land in the last one
+#define HISTOGRAM_BUCKETS 10000
+#define HISTOGRAM_STEP_MS 0.1
+
+typedef enum {
+    PATTERN_IDLE,
+    PATTERN_RANDOM,
+    PATTERN_CIRCLE,
+    PATTERN_FIRE,
+    PATTERN_STALL
+} Pattern;
+
+static const char *pattern_names[] = {"idle", "random", "circle", "fire",
+                                      "stall"};
+
+typedef enum {
+    BOT_IDLE,
+    BOT_CONNECTING,
+    BOT_HANDSHAKE,
+    BOT_PLAYING,
+    BOT_STALLED,
+    BOT_CLOSED
+} Bot_State;
+
+/*
+ * A scripted player: `input` is the last one sent, `step` counts the pattern
+ * steps taken, `sent_at` the send times of the last commands, to time their
+ * acknowledgement. `last_tick` is the tick of the last snapshot received, at
+ * `last_tick_at`.
+ */
+typedef struct {
+    int fd;
+    Bot_State state;
+    Client_Session session;
+    Frame_Reader reader;
+    unsigned input;
+    size_t step;
+    unsigned seed;
+    uint32_t sequence;
+    uint32_t ack;
+    uint32_t last_tick;
+    double last_tick_at;
+    double connected_at;
+    double next_step_at;
+    double next_ping_at;
+    double sent_at[SEQUENCE_HISTORY];
+} Bot;
+
+typedef struct {
+    uint32_t buckets[HISTOGRAM_BUCKETS];
+    size_t count;
+    double sum;
+    double max;
+} Histogram;
+
+// Whole run, across all the bots
+typedef struct {
+    size_t playing;
+    size_t rejected;
+    size_t failed;
+    size_t dropped;
+    size_t snapshots;
+    size_t commands;
+    size_t bytes_in;
+    size_t bytes_out;
+    Histogram tick_ms;
+    Histogram input_ms;
+    Histogram age_ms;
+    Histogram rtt_ms;
+    Histogram handshake_ms;
+} Loadgen_Stats;
+
+typedef struct {
+    const char *host;
+    int port;
+    size_t bots;
+    double rate;
+    double duration;
+    Pattern pattern;
+    double step;
+    unsigned caps;
+} Loadgen_Options;
+
+static Loadgen_Stats stats;
+// Where decoded snapshots land, bots are served one at a time
+static unsigned char frame[CLIENT_SESSION_BUFSIZE];
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void histogram_add(Histogram *histogram, double ms)
+{
+    size_t bucket = ms / HISTOGRAM_STEP_MS;
+    if (bucket >= HISTOGRAM_BUCKETS) bucket = HISTOGRAM_BUCKETS - 1;
+    histogram->buckets[bucket]++;
+    histogram->count++;
+    histogram->sum += ms;
+    if (ms > histogram->max) histogram->max = ms;
+}
+
+// Upper bound of the bucket holding the p-th sample, 0 if there's none
+static double histogram_percentile(const Histogram *histogram, double p)
+{
+    size_t rank = p * histogram->count, seen = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        seen += histogram->buckets[i];
+        if (seen > rank) return (i + 1) * HISTOGRAM_STEP_MS;
+    }
+    return 0.0;
+}
+
+static void print_histogram(const char *name, const Histogram *histogram,
+                            bool last)
+{
+    printf("  \"%s\": {\"count\": %zu, \"mean\": %.2f, \"p50\": %.1f, "
+           "\"p95\": %.1f, \"p99\": %.1f, \"max\": %.2f}%s\n",
+           name, histogram->count,
+           histogram->count ? histogram->sum / histogram->count : 0.0,
+           histogram_percentile(histogram, 0.50),
+           histogram_percentile(histogram, 0.95),
+           histogram_percentile(histogram, 0.99), histogram->max,
+           last ? "" : ",");
+}
+
+static void bot_close(Bot *bot)
+{
+    if (bot->state == BOT_PLAYING || bot->state == BOT_STALLED) {
+        stats.playing--;
+        stats.dropped++;
+    } else if (bot->state == BOT_HANDSHAKE) {
+        stats.rejected++;
+    } else if (bot->state == BOT_CONNECTING) {
+        stats.failed++;
+    }
+    close(bot->fd);
+    bot->fd    = -1;
+    bot->state = BOT_CLOSED;
+}
+
+// A short write would leave the stream torn, the bot is closed then
+static int bot_send(Bot *bot, const unsigned char *buf, size_t len)
+{
+    if (network_send(bot->fd, buf, len) != (ssize_t)len) {
+        bot_close(bot);
+        return -1;
+    }
+    stats.bytes_out += len;
+    return 0;
+}
+
+static int bot_connect(Bot *bot, int epfd, const struct addrinfo *addr,
+                       Pattern pattern, unsigned seed)
+{
+    const int rcvbuf  = LOADGEN_STALL_RCVBUF;
+    memset(bot, 0x00, sizeof(*bot));
+    bot->seed         = seed;
+    bot->connected_at = now_seconds();
+    bot->state        = BOT_CONNECTING;
+    bot->fd           = socket(addr->ai_family, addr->ai_socktype, 0);
+    if (bot->fd < 0) goto err;
+    if (fcntl(bot->fd, F_SETFL, O_NONBLOCK) < 0) goto close_fd;
+    // Set before connecting, the window is agreed on in the handshake
+    if (pattern == PATTERN_STALL &&
+        setsockopt(bot->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) < 0)
+        goto close_fd;
+    if (connect(bot->fd, addr->ai_addr, addr->ai_addrlen) < 0 &&
+        errno != EINPROGRESS)
+        goto close_fd;
+
+    struct epoll_event event = {.events = EPOLLOUT, .data.ptr = bot};
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, bot->fd, &event) < 0) goto close_fd;
+    return 0;
+
+close_fd:
+
+    close(bot->fd);
+
+err:
+
+    bot->fd    = -1;
+    bot->state = BOT_CLOSED;
+    stats.failed++;
+    return -1;
+}
+
+// Connection established, or failed: says hello and waits for the reply
+static void bot_connected(Bot *bot, int epfd, unsigned caps)
+{
+    unsigned char buf[CLIENT_SESSION_BUFSIZE];
+    int err           = 0;
+    socklen_t len     = sizeof(err);
+    const Hello hello = {.version = PROTOCOL_VERSION, .caps = caps};
+
+    if (getsockopt(bot->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err) {
+        bot_close(bot);
+        return;
+    }
+
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = bot};
+    if (epoll_ctl(epfd, EPOLL_CTL_MOD, bot->fd, &event) < 0) {
+        bot_close(bot);
+        return;
+    }
+    bot->state = BOT_HANDSHAKE;
+    bot_send(bot, buf, protocol_serialize_hello(&hello, buf));
+}
+
+// Stops reading, the server fills the socket up, only a hang up is waited for
+static void bot_stall(Bot *bot, int epfd)
+{
+    struct epoll_event event = {.events = EPOLLRDHUP, .data.ptr = bot};
+    if (epoll_ctl(epfd, EPOLL_CTL_MOD, bot->fd, &event) < 0) {
+        bot_close(bot);
+        return;
+    }
+    bot->state = BOT_STALLED;
+}
+
+// Seeded per bot, so that a run can be replayed
+static unsigned next_input(Bot *bot, Pattern pattern)
+{
+    static const unsigned directions[] = {INPUT_UP, INPUT_RIGHT, INPUT_DOWN,
+                                          INPUT_LEFT};
+    bot->step++;
+    switch (pattern) {
+        case PATTERN_RANDOM: {
+            unsigned roll  = rand_r(&bot->seed);
+            unsigned input = roll % 5 < 4 ? directions[roll % 5] : 0;
+            return (roll >> 8) % 4 == 0 ? input | INPUT_FIRE : input;
+        }
+        case PATTERN_CIRCLE:
+            return directions[bot->step % 4];
+        case PATTERN_FIRE:
+            return bot->step % 2 ? INPUT_FIRE : 0;
+        default:
+            return 0;
+    }
+}
+
+/*
+ * Takes the next step of the pattern, sessions without CAP_INPUT get the
+ * equivalent action, fire winning over moving, as the client does.
+ */
+static void bot_step(Bot *bot, const Loadgen_Options *options, double now)
+{
+    unsigned char buf[CLIENT_SESSION_BUFSIZE];
+    unsigned input         = next_input(bot, options->pattern);
+    Client_Command command = {CLIENT_COMMAND_INPUT, input, bot->sequence + 1,
+                              bot->last_tick};
+
+    if (!(bot->session.hello.caps & CAP_INPUT)) {
+        command.kind  = CLIENT_COMMAND_ACTION;
+        command.value = input & INPUT_FIRE ? FIRE
+                                           : game_state_input_direction(input);
+        if (command.value == IDLE) return;
+    } else if (input == bot->input) {
+        return;
+    }
+
+    if (bot_send(bot, buf, client_session_encode(&bot->session, &command,
+                                                 buf)) < 0)
+        return;
+    bot->input                                       = input;
+    bot->sent_at[++bot->sequence % SEQUENCE_HISTORY] = now;
+    stats.commands++;
+}
+
+static void bot_ping(Bot *bot, double now)
+{
+    unsigned char buf[CLIENT_SESSION_BUFSIZE];
+    uint32_t stamp = (uint64_t)(now * 1e6);
+    bot_send(bot, buf, protocol_serialize_ping(MSG_PING, stamp, buf));
+}
+
+static void bot_snapshot(Bot *bot, const Snapshot_View *view, double now)
+{
+    stats.snapshots++;
+    if (bot->session.hello.version < PROTOCOL_VERSION_SEQUENCED) return;
+
+    if (bot->last_tick_at > 0.0 && view->tick > bot->last_tick)
+        histogram_add(&stats.tick_ms, (now - bot->last_tick_at) * 1e3 /
+                                          (view->tick - bot->last_tick));
+    bot->last_tick    = view->tick;
+    bot->last_tick_at = now;
+
+    if (view->ack > bot->ack) {
+        if (bot->sequence - view->ack < SEQUENCE_HISTORY)
+            histogram_add(&stats.input_ms,
+                          (now - bot->sent_at[view->ack % SEQUENCE_HISTORY]) *
+                              1e3);
+        bot->ack = view->ack;
+    }
+}
+
+// Frames before the hello reply are the legacy sync, skipped
+static void bot_frame(Bot *bot, const unsigned char *buf, size_t len,
+                      double now)
+{
+    Snapshot_View view;
+    uint32_t stamp;
+
+    if (bot->state == BOT_HANDSHAKE) {
+        Hello agreed;
+        if (protocol_deserialize_hello(buf, len, &agreed) < 0) return;
+        client_session_init(&bot->session, &agreed);
+        histogram_add(&stats.handshake_ms, (now - bot->connected_at) * 1e3);
+        bot->state        = BOT_PLAYING;
+        bot->next_step_at = now;
+        bot->next_ping_at = now;
+        stats.playing++;
+        return;
+    }
+
+    if (protocol_message_type(buf, len) == MSG_PONG) {
+        if (protocol_deserialize_ping(buf, len, MSG_PONG, &stamp) > 0)
+            histogram_add(&stats.rtt_ms,
+                          (uint32_t)((uint64_t)(now * 1e6) - stamp) / 1e3);
+        return;
+    }
+
+    if (client_session_decode(&bot->session, buf, len, frame, sizeof(frame),
+                              &view) > 0)
+        bot_snapshot(bot, &view, now);
+}
+
+// Reads until the socket is drained, every complete frame handled on the way
+static void bot_read(Bot *bot, double now)
+{
+    const unsigned char *buf;
+    ssize_t n;
+
+    while (bot->state != BOT_CLOSED) {
+        n = network_reader_fill(bot->fd, &bot->reader);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (n <= 0) {
+            bot_close(bot);
+            return;
+        }
+        stats.bytes_in += n;
+        while (bot->state != BOT_CLOSED &&
+               (n = network_reader_next(&bot->reader, &buf)) > 0)
+            bot_frame(bot, buf, n, now);
+        if (n < 0) bot_close(bot);
+    }
+}
+
+static void run(Bot *bots, int epfd, const struct addrinfo *addr,
+                const Loadgen_Options *options)
+{
+    struct epoll_event events[LOADGEN_EVENTS];
+    double start = now_seconds(), end = start + options->duration;
+    double report_at = start + 1.0;
+    size_t launched = 0, last_snapshots = 0;
+
+    for (double now = start; now < end; now = now_seconds()) {
+        // Connects go out at the given rate, not all at once
+        size_t due = (now - start) * options->rate + 1;
+        for (; launched < options->bots && launched < due; ++launched)
+            bot_connect(&bots[launched], epfd, addr, options->pattern,
+                        launched + 1);
+
+        int n = epoll_wait(epfd, events, LOADGEN_EVENTS, LOADGEN_WAIT_MS);
+        if (n < 0 && errno != EINTR) {
+            perror("epoll_wait() error");
+            return;
+        }
+        now = now_seconds();
+        for (int i = 0; i < n; ++i) {
+            Bot *bot = events[i].data.ptr;
+            if (bot->state == BOT_CONNECTING) {
+                bot_connected(bot, epfd, options->caps);
+            } else if (bot->state == BOT_STALLED) {
+                bot_close(bot);
+            } else if (bot->state != BOT_CLOSED) {
+                bot_read(bot, now);
+                if (options->pattern == PATTERN_STALL &&
+                    bot->state == BOT_PLAYING)
+                    bot_stall(bot, epfd);
+            }
+        }
+
+        for (size_t i = 0; i < launched; ++i) {
+            Bot *bot = &bots[i];
+            if (bot->state == BOT_PLAYING && now >= bot->next_step_at) {
+                if (bot->last_tick_at > 0.0)
+                    histogram_add(&stats.age_ms,
+                                  (now - bot->last_tick_at) * 1e3);
+                bot_step(bot, options, now);
+                bot->next_step_at = now + options->step;
+            }
+            if (bot->state == BOT_PLAYING &&
+                (bot->session.hello.caps & CAP_PING) &&
+                now >= bot->next_ping_at) {
+                bot_ping(bot, now);
+                bot->next_ping_at = now + LOADGEN_PING;
+            }
+        }
+
+        if (now >= report_at) {
+            fprintf(stderr,
+                    "[INFO] %.0fs: %zu launched, %zu playing, %zu rejected, "
+                    "%zu failed, %zu dropped, %zu snapshots/s\n",
+                    now - start, launched, stats.playing, stats.rejected,
+                    stats.failed, stats.dropped,
+                    stats.snapshots - last_snapshots);
+            last_snapshots  = stats.snapshots;
+            report_at      += 1.0;
+        }
+    }
+}
+
+static void report(const Loadgen_Options *options)
+{
+    printf("{\n");
+    printf("  \"bots\": %zu, \"duration_s\": %.1f, \"pattern\": \"%s\",\n",
+           options->bots, options->duration,
+           pattern_names[options->pattern]);
+    printf("  \"connections\": {\"playing\": %zu, \"rejected\": %zu, "
+           "\"failed\": %zu, \"dropped\": %zu},\n",
+           stats.playing, stats.rejected, stats.failed, stats.dropped);
+    printf("  \"throughput\": {\"snapshots_per_s\": %.1f, "
+           "\"commands_per_s\": %.1f, \"bytes_in_per_s\": %.1f, "
+           "\"bytes_out_per_s\": %.1f},\n",
+           stats.snapshots / options->duration,
+           stats.commands / options->duration,
+           stats.bytes_in / options->duration,
+           stats.bytes_out / options->duration);
+    print_histogram("tick_interval_ms", &stats.tick_ms, false);
+    print_histogram("input_latency_ms", &stats.input_ms, false);
+    print_histogram("snapshot_age_ms", &stats.age_ms, false);
+    print_histogram("rtt_ms", &stats.rtt_ms, false);
+    print_histogram("handshake_ms", &stats.handshake_ms, true);
+    printf("}\n");
+}
+
+// Thousands of bots need as many descriptors, as far as the hard limit goes
+static void raise_fd_limit(size_t bots)
+{
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) < 0) return;
+    rlim_t wanted = bots + 64;
+    if (limit.rlim_cur >= wanted) return;
+    limit.rlim_cur = wanted < limit.rlim_max ? wanted : limit.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &limit) < 0) perror("setrlimit() error");
+}
+
+static int parse_pattern(const char *name, Pattern *pattern)
+{
+    for (size_t i = 0; i < sizeof(pattern_names) / sizeof(*pattern_names);
+         ++i) {
+        if (strcmp(name, pattern_names[i]) == 0) {
+            *pattern = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-h host] [-p port] [-n bots] [-r connects/s] "
+            "[-d seconds] [-m idle|random|circle|fire|stall] [-i step ms] "
+            "[-z]\n",
+            name);
+}
+
+int main(int argc, char **argv)
+{
+    Loadgen_Options options = {.host     = "127.0.0.1",
+                               .port     = 6699,
+                               .bots     = 100,
+                               .rate     = 200.0,
+                               .duration = 10.0,
+                               .pattern  = PATTERN_RANDOM,
+                               .step     = 0.2,
+                               .caps     = PROTOCOL_CAPS & ~CAP_COMPRESS};
+    int err                 = EXIT_FAILURE;
+
+    for (int i = 1; i < argc; ++i) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "-h") == 0 && has_value) {
+            options.host = argv[++i];
+        } else if (strcmp(argv[i], "-p") == 0 && has_value) {
+            options.port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-n") == 0 && has_value) {
+            options.bots = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-r") == 0 && has_value) {
+            options.rate = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-d") == 0 && has_value) {
+            options.duration = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-m") == 0 && has_value) {
+            if (parse_pattern(argv[++i], &options.pattern) < 0) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "-i") == 0 && has_value) {
+            options.step = atof(argv[++i]) / 1e3;
+        } else if (strcmp(argv[i], "-z") == 0) {
+            options.caps |= CAP_COMPRESS;
+        } else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (options.bots == 0 || options.rate <= 0.0 || options.duration <= 0.0 ||
+        options.step <= 0.0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char port[6];
+    struct addrinfo *addr;
+    const struct addrinfo hints = {.ai_family   = AF_UNSPEC,
+                                   .ai_socktype = SOCK_STREAM};
+    snprintf(port, sizeof(port), "%d", options.port);
+    if (getaddrinfo(options.host, port, &hints, &addr) != 0) {
+        fprintf(stderr, "can't resolve %s:%s\n", options.host, port);
+        return EXIT_FAILURE;
+    }
+
+    raise_fd_limit(options.bots);
+    Bot *bots = calloc(options.bots, sizeof(*bots));
+    int epfd  = epoll_create1(0);
+    if (!bots || epfd < 0) {
+        perror("loadgen setup error");
+        goto exit;
+    }
+
+    run(bots, epfd, addr, &options);
+    report(&options);
+    err = EXIT_SUCCESS;
+
+exit:
+    if (bots)
+        for (size_t i = 0; i < options.bots; ++i)
+            if (bots[i].state != BOT_IDLE && bots[i].fd >= 0)
+                close(bots[i].fd);
+    if (epfd >= 0) close(epfd);
+    free(bots);
+    freeaddrinfo(addr);
+    return err;
+}
@@ -0,0 +1,99 @@
+/*
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                    Version 2, December 2004
+ *
+ * Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ * Everyone is permitted to copy and distribute verbatim or modified
+ * copies of this license document, and changing it is allowed as long
+ * as the name is changed.
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *   TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *  0. You just DO WHAT THE FUCK YOU WANT TO.
+ *
+ * Offline asset packer.
+ *
+ * Bakes every sprite in the assets directories into a single pack file: the
+ * PNGs are decoded and packed in one RGBA atlas, written after an index of
+ * the sprites, see asset_pack.h. The client maps the pack and uploads the
+ * atlas as it is, skipping the directory walk and the PNG decoding at
+ * startup. The client falls back to the directories only when the pack is
+ * missing or unreadable, a pack older than the sprites is loaded as it is:
+ * rebuild it by hand whenever a sprite is added or changed.
+ *
+ * Usage: battletank-pack [output path, ASSET_PACK_PATH by default]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asset_pack.h"
+#include "raylib.h"
+#include "sprite.h"
+
+int main(int argc, char **argv)
+{
+    const char *path = argc > 1 ? argv[1] : ASSET_PACK_PATH;
+    int err          = EXIT_FAILURE;
+    Sprite_Repo repo;
+    Image atlas;
+
+    SetTraceLogLevel(LOG_WARNING);
+    sprite_repo_scan(&repo);
+
+    size_t count              = sprite_repo_count(&repo);
+    Rectangle *placed         = calloc(count, sizeof(*placed));
+    Asset_Pack_Entry *entries = calloc(count, sizeof(*entries));
+    if (!placed || !entries) goto exit;
+    if (sprite_repo_build_atlas(&repo, &atlas, placed) < 0) {
+        fprintf(stderr, "no sprites to pack or unreadable images\n");
+        goto exit;
+    }
+
+    size_t n = 0;
+    for (Sprite_Kind kind = SPACESHIP; kind < SPRITES_COUNT; ++kind) {
+        const Sprite_Collection *collection = &repo.collections[kind];
+        for (size_t i = 0; i < collection->count; ++i, ++n) {
+            const char *name = strrchr(collection->sprites[i].path, '/') + 1;
+            if (strlen(name) >= ASSET_PACK_NAME_SIZE) {
+                fprintf(stderr, "sprite name too long: %s\n", name);
+                goto unload;
+            }
+            entries[n].kind   = kind;
+            entries[n].x      = placed[n].x;
+            entries[n].y      = placed[n].y;
+            entries[n].width  = placed[n].width;
+            entries[n].height = placed[n].height;
+            strcpy(entries[n].name, name);
+        }
+    }
+
+    const Asset_Pack_Header header = {
+        .entries     = count,
+        .width       = atlas.width,
+        .height      = atlas.height,
+        .format      = atlas.format,
+        .pixels_size = (uint64_t)atlas.width * atlas.height * 4};
+    if (atlas.format != PIXELFORMAT_UNCOMPRESSED_R8G8B8A8 ||
+        asset_pack_write(path, &header, entries, atlas.data) < 0) {
+        perror("asset_pack_write() error");
+        goto unload;
+    }
+
+    printf("Packed %zu sprites in a %dx%d atlas into %s\n", count, atlas.width,
+           atlas.height, path);
+    err = EXIT_SUCCESS;
+
+unload:
+    UnloadImage(atlas);
+
+exit:
+    // Sprites were only scanned, there are no textures to unload
+    for (Sprite_Kind kind = SPACESHIP; kind < SPRITES_COUNT; ++kind)
+        sprite_collection_free(&repo.collections[kind]);
+    free(placed);
+    free(entries);
+    return err;
+}
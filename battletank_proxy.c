@@ -0,0 +1,456 @@
+/*
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *                    Version 2, December 2004
+ *
+ * Copyright (C) 2004 Sam Hocevar <sam@hocevar.net>
+ *
+ * Everyone is permitted to copy and distribute verbatim or modified
+ * copies of this license document, and changing it is allowed as long
+ * as the name is changed.
+ *
+ *            DO WHAT THE FUCK YOU WANT TO PUBLIC LICENSE
+ *   TERMS AND CONDITIONS FOR COPYING, DISTRIBUTION AND MODIFICATION
+ *
+ *  0. You just DO WHAT THE FUCK YOU WANT TO.
+ *
+ * Network impairment proxy, sits between the clients (or the loadgen) and
+ * the server and makes loopback look like a real network.
+ *
+ * Every connection accepted is paired with one to the server, whatever is
+ * read on either end is held back before being forwarded, each direction on
+ * its own:
+ *
+ * - latency   fixed delay, one way, the round trip gets it twice
+ * - jitter    random delay on top, uniform in [-jitter, +jitter]
+ * - bandwidth bytes per second the link serializes, queueing what exceeds
+ * - loss      chance a read is lost, game traffic is TCP so it's delivered
+ *             anyway once retransmitted, PROXY_RTO_MS later, and everything
+ *             behind it waits, the head-of-line blocking a real loss causes
+ *
+ * TCP never reorders, nor does the proxy: data is released in the order it
+ * was read, a chunk with less jitter waits for the one before it.
+ *
+ * Scenarios set all of the above at once, options given after -s override
+ * them. With -v every chunk forwarded is logged as CSV on stderr: time since
+ * start, connection, direction, bytes, delay and whether it was lost.
+ *
+ * Usage: battletank-proxy [-l listen port] [-u server host:port]
+ *                         [-s lan|wifi|mobile|lossy] [-d latency ms]
+ *                         [-j jitter ms] [-b bandwidth KB/s] [-p loss %]
+ *                         [-S seed] [-v]
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PROXY_LINKS     256
+#define PROXY_CHUNK     4096
+// Bytes held back per direction before reading stops, the sender's socket
+// buffer fills up then, as it would behind a slow link
+#define PROXY_QUEUE_MAX (1 << 20)
+// Retransmission timeout of a lost chunk, the Linux minimum RTO
+#define PROXY_RTO_MS    200.0
+// Longest poll wait, releases are checked at least this often
+#define PROXY_WAIT_MS   10
+
+typedef struct {
+    const char *name;
+    double latency_ms;
+    double jitter_ms;
+    double bandwidth;  // bytes per second, 0 for unlimited
+    double loss;       // 0 to 1
+} Impairment;
+
+static const Impairment scenarios[] = {
+    {"lan", 1.0, 0.5, 0.0, 0.0},
+    {"wifi", 15.0, 10.0, 2e6, 0.005},
+    {"mobile", 60.0, 25.0, 250e3, 0.01},
+    {"lossy", 40.0, 15.0, 0.0, 0.05},
+};
+
+#define SCENARIOS_COUNT (sizeof(scenarios) / sizeof(scenarios[0]))
+
+typedef struct chunk {
+    struct chunk *next;
+    double read_at;
+    double release_at;
+    bool lost;
+    size_t len;
+    size_t sent;
+    unsigned char data[];
+} Chunk;
+
+/*
+ * One direction of a link: chunks read from `from` wait in the queue until
+ * their release time, then go out on `to` in order. `link_free_at` is when
+ * the simulated link is done serializing what was queued so far.
+ */
+typedef struct {
+    int from;
+    int to;
+    const char *name;
+    Chunk *head;
+    Chunk *tail;
+    size_t queued;
+    double link_free_at;
+    double last_release_at;
+} Pipe;
+
+typedef struct {
+    bool open;
+    size_t id;
+    Pipe pipes[2];
+} Link;
+
+static Impairment impairment;
+static Link links[PROXY_LINKS];
+static bool verbose;
+static double started_at;
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static double uniform(void) { return rand() / (double)RAND_MAX; }
+
+/*
+ * Release time of `len` bytes read now: serialized once the link is done
+ * with what's ahead, then delayed by latency and jitter, if lost by a
+ * retransmission timeout as well, never before the previous chunk.
+ */
+static double schedule(Pipe *pipe, size_t len, double now, bool *lost)
+{
+    double start = pipe->link_free_at > now ? pipe->link_free_at : now;
+    double sent  = start;
+    if (impairment.bandwidth > 0.0) sent += len * 1e3 / impairment.bandwidth;
+    pipe->link_free_at = sent;
+
+    double delay = impairment.latency_ms +
+                   impairment.jitter_ms * (2.0 * uniform() - 1.0);
+    if (delay < 0.0) delay = 0.0;
+    *lost = impairment.loss > 0.0 && uniform() < impairment.loss;
+    if (*lost) delay += PROXY_RTO_MS;
+
+    double release = sent + delay;
+    if (release < pipe->last_release_at) release = pipe->last_release_at;
+    pipe->last_release_at = release;
+    return release;
+}
+
+static void pipe_free(Pipe *pipe)
+{
+    while (pipe->head) {
+        Chunk *next = pipe->head->next;
+        free(pipe->head);
+        pipe->head = next;
+    }
+    pipe->tail   = NULL;
+    pipe->queued = 0;
+}
+
+static void link_close(Link *link)
+{
+    for (int i = 0; i < 2; ++i) pipe_free(&link->pipes[i]);
+    close(link->pipes[0].from);
+    close(link->pipes[0].to);
+    link->open = false;
+    fprintf(stderr, "[INFO] Connection %zu closed\n", link->id);
+}
+
+// Reads what's available, -1 once the peer is gone
+static int pipe_read(Pipe *pipe)
+{
+    unsigned char buf[PROXY_CHUNK];
+    ssize_t n = read(pipe->from, buf, sizeof(buf));
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return 0;
+    if (n <= 0) return -1;
+
+    Chunk *chunk = malloc(sizeof(*chunk) + n);
+    if (!chunk) return -1;
+    chunk->next       = NULL;
+    chunk->read_at    = now_ms();
+    chunk->release_at = schedule(pipe, n, chunk->read_at, &chunk->lost);
+    chunk->len        = n;
+    chunk->sent       = 0;
+    memcpy(chunk->data, buf, n);
+
+    if (pipe->tail)
+        pipe->tail->next = chunk;
+    else
+        pipe->head = chunk;
+    pipe->tail    = chunk;
+    pipe->queued += n;
+    return 0;
+}
+
+// Forwards the chunks due, in order, -1 once the peer is gone
+static int pipe_flush(Pipe *pipe, size_t id, double now)
+{
+    while (pipe->head && pipe->head->release_at <= now) {
+        Chunk *chunk = pipe->head;
+        ssize_t n =
+            write(pipe->to, chunk->data + chunk->sent, chunk->len - chunk->sent);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+        if (n < 0) return -1;
+        chunk->sent += n;
+        if (chunk->sent < chunk->len) return 0;
+
+        if (verbose)
+            fprintf(stderr, "%.3f,%zu,%s,%zu,%.3f,%d\n",
+                    chunk->read_at - started_at, id, pipe->name, chunk->len,
+                    now - chunk->read_at, chunk->lost);
+        pipe->queued -= chunk->len;
+        pipe->head    = chunk->next;
+        if (!pipe->head) pipe->tail = NULL;
+        free(chunk);
+    }
+    return 0;
+}
+
+static int set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static int listen_on(int port)
+{
+    struct sockaddr_in addr = {.sin_family      = AF_INET,
+                               .sin_port        = htons(port),
+                               .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    int yes                 = 1;
+    int fd                  = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(fd, 64) < 0 || set_nonblocking(fd) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int connect_upstream(const struct addrinfo *upstream)
+{
+    int fd = socket(upstream->ai_family, upstream->ai_socktype, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, upstream->ai_addr, upstream->ai_addrlen) < 0 ||
+        set_nonblocking(fd) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Pairs a client just accepted with a new connection to the server
+static void accept_link(int listen_fd, const struct addrinfo *upstream)
+{
+    static size_t next_id = 0;
+    int client            = accept(listen_fd, NULL, NULL);
+    if (client < 0) return;
+
+    Link *link = NULL;
+    for (size_t i = 0; i < PROXY_LINKS && !link; ++i)
+        if (!links[i].open) link = &links[i];
+    int server = link ? connect_upstream(upstream) : -1;
+    if (server < 0 || set_nonblocking(client) < 0) {
+        fprintf(stderr, "[INFO] Can't forward a new connection, dropped\n");
+        if (server >= 0) close(server);
+        close(client);
+        return;
+    }
+
+    memset(link, 0x00, sizeof(*link));
+    link->open     = true;
+    link->id       = next_id++;
+    link->pipes[0] = (Pipe){.from = client, .to = server, .name = "up"};
+    link->pipes[1] = (Pipe){.from = server, .to = client, .name = "down"};
+    fprintf(stderr, "[INFO] Connection %zu forwarded\n", link->id);
+}
+
+// Time to the next release still to come, capped to PROXY_WAIT_MS
+static int next_wait(double now)
+{
+    double wait = PROXY_WAIT_MS;
+    for (size_t i = 0; i < PROXY_LINKS; ++i) {
+        if (!links[i].open) continue;
+        for (int p = 0; p < 2; ++p) {
+            const Chunk *head = links[i].pipes[p].head;
+            if (head && head->release_at > now && head->release_at - now < wait)
+                wait = head->release_at - now;
+        }
+    }
+    return (int)wait;
+}
+
+static void flush_links(void)
+{
+    double now = now_ms();
+    for (size_t i = 0; i < PROXY_LINKS; ++i) {
+        for (int p = 0; p < 2 && links[i].open; ++p)
+            if (pipe_flush(&links[i].pipes[p], links[i].id, now) < 0)
+                link_close(&links[i]);
+    }
+}
+
+/*
+ * Each link polls both of its sockets: for reading as long as the direction
+ * they feed isn't over PROXY_QUEUE_MAX, for writing when the direction they
+ * are fed by has a chunk due that didn't fit in the socket buffer.
+ */
+static void proxy_loop(int listen_fd, const struct addrinfo *upstream)
+{
+    struct pollfd fds[1 + PROXY_LINKS * 2];
+    Link *polled[PROXY_LINKS * 2];
+
+    while (1) {
+        flush_links();
+
+        double now = now_ms();
+        size_t n   = 1;
+        fds[0]     = (struct pollfd){.fd = listen_fd, .events = POLLIN};
+        for (size_t i = 0; i < PROXY_LINKS; ++i) {
+            if (!links[i].open) continue;
+            for (int p = 0; p < 2; ++p) {
+                const Pipe *in  = &links[i].pipes[p];
+                const Pipe *out = &links[i].pipes[1 - p];
+                short events    = in->queued < PROXY_QUEUE_MAX ? POLLIN : 0;
+                if (out->head && out->head->release_at <= now)
+                    events |= POLLOUT;
+                polled[n - 1] = &links[i];
+                fds[n++] = (struct pollfd){.fd = in->from, .events = events};
+            }
+        }
+
+        if (poll(fds, n, next_wait(now)) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll() error");
+            return;
+        }
+
+        if (fds[0].revents & POLLIN) accept_link(listen_fd, upstream);
+        for (size_t i = 1; i < n; ++i) {
+            Link *link = polled[i - 1];
+            Pipe *in   = &link->pipes[(i - 1) % 2];
+            if (!link->open) continue;
+            if ((fds[i].revents & (POLLIN | POLLHUP | POLLERR)) &&
+                pipe_read(in) < 0)
+                link_close(link);
+        }
+    }
+}
+
+static int parse_upstream(const char *spec, struct addrinfo **upstream)
+{
+    char host[256];
+    const char *colon = strrchr(spec, ':');
+    if (!colon || (size_t)(colon - spec) >= sizeof(host)) return -1;
+    memcpy(host, spec, colon - spec);
+    host[colon - spec] = '\0';
+
+    const struct addrinfo hints = {.ai_family   = AF_UNSPEC,
+                                   .ai_socktype = SOCK_STREAM};
+    return getaddrinfo(host, colon + 1, &hints, upstream) == 0 ? 0 : -1;
+}
+
+static int parse_scenario(const char *name)
+{
+    for (size_t i = 0; i < SCENARIOS_COUNT; ++i) {
+        if (strcmp(name, scenarios[i].name) == 0) {
+            impairment = scenarios[i];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-l listen port] [-u server host:port] "
+            "[-s lan|wifi|mobile|lossy] [-d latency ms] [-j jitter ms] "
+            "[-b bandwidth KB/s] [-p loss %%] [-S seed] [-v]\n",
+            name);
+}
+
+int main(int argc, char **argv)
+{
+    int port                  = 6700;
+    const char *upstream_spec = "127.0.0.1:6699";
+    unsigned seed             = 1;
+    struct addrinfo *upstream;
+
+    impairment = (Impairment){.name = "custom"};
+    for (int i = 1; i < argc; ++i) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "-l") == 0 && has_value) {
+            port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-u") == 0 && has_value) {
+            upstream_spec = argv[++i];
+        } else if (strcmp(argv[i], "-s") == 0 && has_value) {
+            if (parse_scenario(argv[++i]) < 0) goto usage;
+        } else if (strcmp(argv[i], "-d") == 0 && has_value) {
+            impairment.latency_ms = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-j") == 0 && has_value) {
+            impairment.jitter_ms = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-b") == 0 && has_value) {
+            impairment.bandwidth = atof(argv[++i]) * 1e3;
+        } else if (strcmp(argv[i], "-p") == 0 && has_value) {
+            impairment.loss = atof(argv[++i]) / 100.0;
+        } else if (strcmp(argv[i], "-S") == 0 && has_value) {
+            seed = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-v") == 0) {
+            verbose = true;
+        } else {
+            goto usage;
+        }
+    }
+
+    if (parse_upstream(upstream_spec, &upstream) < 0) {
+        fprintf(stderr, "can't resolve %s\n", upstream_spec);
+        return EXIT_FAILURE;
+    }
+    int listen_fd = listen_on(port);
+    if (listen_fd < 0) {
+        perror("listen_on() error");
+        freeaddrinfo(upstream);
+        return EXIT_FAILURE;
+    }
+
+    // A peer gone mid-write is handled as a closed link
+    signal(SIGPIPE, SIG_IGN);
+    srand(seed);
+    started_at = now_ms();
+    fprintf(stderr,
+            "[INFO] Proxying :%d to %s, %s: latency %.1f ms, jitter %.1f ms, "
+            "bandwidth %.0f B/s, loss %.1f%%\n",
+            port, upstream_spec, impairment.name, impairment.latency_ms,
+            impairment.jitter_ms, impairment.bandwidth,
+            impairment.loss * 100.0);
+    if (verbose)
+        fprintf(stderr, "time_ms,connection,direction,bytes,delay_ms,lost\n");
+
+    proxy_loop(listen_fd, upstream);
+
+    close(listen_fd);
+    freeaddrinfo(upstream);
+    return EXIT_FAILURE;
+
+usage:
+    usage(argv[0]);
+    return EXIT_FAILURE;
+}
@@ -30,6 +30,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <netdb.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -41,18 +42,68 @@
 #include <unistd.h>
 
 #include "game_state.h"
+#include "history.h"
+#include "metrics.h"
 #include "network.h"
+#include "profiler.h"
 #include "protocol.h"
 
 // We don't expect big payloads
 #define BUFSIZE         2048
 #define BACKLOG         128
-#define TIMEOUT         16000  // ~60 FPS
+#define TIMEOUT         TICK_US  // ~60 FPS
 #define POWERUP_COUNTER 270
+// Updates between two reports of the lag compensation costs, ~10s
+#define HISTORY_REPORT  625
+// Chrome trace of the tick phases, written on SIGUSR2 and at exit
+#define TRACE_PATH      "battletank-trace.json"
+// Scraped for the live metrics, in the Prometheus text format
+#define METRICS_PATH    "/tmp/battletank-metrics.sock"
+// Send buffer of a player, the kernel doubles it. Fixed rather than tuned
+// by the kernel up to megabytes, so a player that stops reading is dropped
+// seconds behind rather than minutes
+#define SEND_BUFFER     (BUFSIZE * 8)
+// Returned by the frame handlers when the frame was fine but the reply
+// couldn't be written whole
+#define REPLY_UNSENT    (-2)
+
+// Cleared by SIGINT and SIGTERM, the loop ends at the next wake up
+static volatile sig_atomic_t running = 1;
+// Set by SIGUSR1 and SIGUSR2, the loop toggles the profiler or dumps it
+static volatile sig_atomic_t toggle_profiler = 0;
+static volatile sig_atomic_t dump_profiler   = 0;
 
 // Generic global game state
 static Game_State game_state = {0};
 
+// Counters of the server loop, the only thread updating them
+static Metrics metrics = {0};
+
+// Tank positions of the last ticks, fires are rewound through them
+static Tank_History history;
+
+// Handles of the entities as of the last broadcast, what the clients
+// negotiating CAP_ENTITIES know about
+static Entity_Table entities = {0};
+
+// A connected player, legacy clients never send a hello and keep the
+// PROTOCOL_VERSION_LEGACY framing for the whole session. `sequence` is the
+// last command applied and `ticks` the updates run since, both acknowledged
+// in every snapshot sent back.
+typedef struct {
+    int fd;
+    unsigned version;
+    unsigned caps;
+    uint32_t sequence;
+    uint32_t ticks;
+    Compress_Context compress;
+    Frame_Reader reader;
+} Connection;
+
+// Settings offered to the clients during the handshake
+static const Hello server_hello = {.version = PROTOCOL_VERSION,
+                                   .caps    = PROTOCOL_CAPS};
+
 /* Set non-blocking socket */
 static int set_nonblocking(int fd)
 {
@@ -129,25 +180,398 @@ static int server_accept(int server_fd)
     if (fd <= 0) goto exit;
 
     (void)set_nonblocking(fd);
+    (void)setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &(int){SEND_BUFFER},
+                     sizeof(int));
     return fd;
 exit:
     if (errno != EWOULDBLOCK && errno != EAGAIN) perror("accept");
     return -1;
 }
 
-static int broadcast(int *client_fds, const unsigned char *buf, size_t count)
+typedef enum {
+    DROP_DISCONNECTED,
+    DROP_MALFORMED,
+    DROP_STALLED,
+    DROP_IO_ERROR
+} Drop_Reason;
+
+// Frees the seat and the tank of a player, counted by reason
+static void drop_client(Connection *client, size_t index, Drop_Reason reason)
 {
-    int written = 0;
-    for (int i = 0; i < FD_SETSIZE; i++) {
-        if (client_fds[i] >= 0) {
-            // TODO check for errors writing
-            written += network_send(client_fds[i], buf, count);
+    // The frames queued for a stalled player would never get through, the
+    // connection is reset rather than left to the kernel to flush
+    const struct linger reset = {.l_onoff = 1, .l_linger = 0};
+    if (reason == DROP_STALLED)
+        (void)setsockopt(client->fd, SOL_SOCKET, SO_LINGER, &reset,
+                         sizeof(reset));
+    close(client->fd);
+    game_state_dismiss_tank(&game_state, index);
+    client->fd = -1;
+    if (reason == DROP_MALFORMED)
+        metrics.dropped++;
+    else if (reason == DROP_STALLED)
+        metrics.stalled++;
+    else if (reason == DROP_IO_ERROR)
+        metrics.io_errors++;
+    else
+        metrics.disconnected++;
+}
+
+// network_send() to a player, counting the bytes out and the writes cut
+// short by a full socket buffer
+static ssize_t send_to(int fd, const unsigned char *buf, size_t count)
+{
+    ssize_t n = network_send(fd, buf, count);
+    if (n > 0) metrics.bytes_out += n;
+    if (n >= 0 && (size_t)n < count) metrics.send_eagain++;
+    return n;
+}
+
+// Why a frame didn't go out whole, network_send() leaves errno at EAGAIN
+// when the socket buffer filled up midway
+static Drop_Reason send_failure(void)
+{
+    return errno == EAGAIN || errno == EWOULDBLOCK ? DROP_STALLED
+                                                   : DROP_IO_ERROR;
+}
+
+/*
+ * Sends the current game state to every connected client, each one in the
+ * encoding negotiated for its connection, every encoding is serialized at
+ * most once per broadcast. Compression runs per client on top of the
+ * versioned snapshot, as each connection has its own history. Clients with
+ * CAP_ENTITIES get the entities spawned and despawned since the last
+ * broadcast first. A client a frame can't be written whole to is dropped,
+ * the rest of the frame is lost and, compressed, its history already counts
+ * the snapshot as sent.
+ */
+static int broadcast(Connection *clients, const Game_State *state)
+{
+    unsigned char legacy[BUFSIZE], typed[BUFSIZE], sequenced[BUFSIZE];
+    unsigned char compressed[BUFSIZE], events[BUFSIZE];
+    ssize_t legacy_size = 0, typed_size = 0, sequenced_size = 0;
+    ssize_t compressed_size = 0, events_size = 0;
+    int written             = 0;
+
+    Entity_Table current;
+    Entity_Event diff[ENTITY_EVENTS_MAX];
+    uint64_t span = profiler_begin();
+    game_state_entities(state, &current);
+    size_t diff_count = entity_table_diff(&entities, &current, diff);
+    if (diff_count > 0)
+        events_size =
+            protocol_serialize_entity_events(diff, diff_count, events);
+    entities = current;
+    profiler_end(PHASE_SERIALIZE, -1, span);
+
+    for (int i = 0; i < MAX_PLAYERS; i++) {
+        if (clients[i].fd < 0) continue;
+        if (events_size > 0 && (clients[i].caps & CAP_ENTITIES)) {
+            if (send_to(clients[i].fd, events, events_size) != events_size)
+                goto unsent;
+            written += events_size;
+        }
+        if (clients[i].version == PROTOCOL_VERSION_LEGACY) {
+            if (legacy_size == 0) {
+                span        = profiler_begin();
+                legacy_size = protocol_serialize_game_state(state, legacy);
+                profiler_end(PHASE_SERIALIZE, -1, span);
+            }
+            if (send_to(clients[i].fd, legacy, legacy_size) != legacy_size)
+                goto unsent;
+            written += legacy_size;
+        } else {
+            unsigned char *versioned = typed;
+            ssize_t *versioned_size  = &typed_size;
+            if (clients[i].version >= PROTOCOL_VERSION_SEQUENCED) {
+                versioned      = sequenced;
+                versioned_size = &sequenced_size;
+            }
+            if (*versioned_size == 0) {
+                span            = profiler_begin();
+                *versioned_size = protocol_serialize_snapshot(
+                    state, clients[i].version, versioned);
+                profiler_end(PHASE_SERIALIZE, -1, span);
+            }
+            // The ack is the only part of the snapshot that differs among
+            // the clients
+            if (clients[i].version >= PROTOCOL_VERSION_SEQUENCED)
+                protocol_snapshot_set_ack(versioned, clients[i].sequence,
+                                          clients[i].ticks);
+            const unsigned char *frame = versioned;
+            ssize_t frame_size         = *versioned_size;
+            if (clients[i].caps & CAP_COMPRESS) {
+                span            = profiler_begin();
+                compressed_size = protocol_compress_snapshot(
+                    &clients[i].compress, versioned, compressed);
+                profiler_end(PHASE_SERIALIZE, i, span);
+                frame      = compressed;
+                frame_size = compressed_size;
+            }
+            if (send_to(clients[i].fd, frame, frame_size) != frame_size)
+                goto unsent;
+            written += frame_size;
         }
+        continue;
+
+    unsent:
+        drop_client(&clients[i], i, send_failure());
+        printf("[INFO] Snapshot to player-%d not sent whole, dropped\n", i);
     }
 
     return written;
 }
 
+/*
+ * Handles the first message of a versioned client, agrees on version and
+ * capabilities and replies with the settings and the assigned tank. With
+ * CAP_ENTITIES the reply is followed by a spawn record for every entity the
+ * next broadcast builds on. Returns -1 if the hello is malformed,
+ * REPLY_UNSENT if the reply couldn't be sent whole.
+ */
+static int handshake(Connection *client, const unsigned char *buf, size_t len,
+                     size_t index)
+{
+    Hello hello, agreed;
+    if (protocol_deserialize_hello(buf, len, &hello) < 0) return -1;
+
+    protocol_negotiate(&server_hello, &hello, &agreed);
+    agreed.player_index = index;
+    client->version     = agreed.version;
+    client->caps        = agreed.caps;
+    client->sequence    = 0;
+    client->ticks       = 0;
+    compress_context_init(&client->compress);
+
+    unsigned char reply[BUFSIZE];
+    ssize_t bytes = protocol_serialize_hello(&agreed, reply);
+    if (send_to(client->fd, reply, bytes) != bytes) return REPLY_UNSENT;
+    if (!(client->caps & CAP_ENTITIES)) return 0;
+
+    const Entity_Table none = {0};
+    Entity_Event spawns[ENTITY_EVENTS_MAX];
+    size_t count = entity_table_diff(&none, &entities, spawns);
+    if (count == 0) return 0;
+
+    bytes = protocol_serialize_entity_events(spawns, count, reply);
+    return send_to(client->fd, reply, bytes) == bytes ? 0 : REPLY_UNSENT;
+}
+
+// Echoes a ping right away, so the round trip the client measures doesn't
+// include the wait for the next tick
+static int answer_ping(Connection *client, const unsigned char *buf,
+                       size_t len)
+{
+    unsigned char reply[BUFSIZE];
+    uint32_t stamp;
+    if (protocol_deserialize_ping(buf, len, MSG_PING, &stamp) < 0) return -1;
+
+    ssize_t n = protocol_serialize_ping(MSG_PONG, stamp, reply);
+    return send_to(client->fd, reply, n) == n ? 0 : REPLY_UNSENT;
+}
+
+/*
+ * Applies a message from a player, actions move the tank right away while
+ * the held input of CAP_INPUT connections is applied by every update until
+ * the next one arrives. Commands of sequenced connections not newer than the
+ * last one applied are duplicates or out of order and get ignored, pings of
+ * CAP_PING connections are answered on the spot. Returns -1 if the frame is
+ * malformed, REPLY_UNSENT if a pong couldn't be sent whole.
+ */
+static int handle_message(Connection *client, const unsigned char *buf,
+                          size_t len, size_t index)
+{
+    unsigned action = IDLE, input = 0;
+    uint32_t sequence = 0, tick = 0;
+    bool is_input     = (client->caps & CAP_INPUT) &&
+                    protocol_message_type(buf, len) == MSG_INPUT;
+    if ((client->caps & CAP_PING) &&
+        protocol_message_type(buf, len) == MSG_PING)
+        return answer_ping(client, buf, len);
+    if (client->version == PROTOCOL_VERSION_LEGACY) {
+        if (protocol_deserialize_action(buf, len, &action) < 0) return -1;
+    } else if (is_input) {
+        if (protocol_deserialize_input(buf, len, client->version, &input,
+                                       &sequence, &tick) < 0)
+            return -1;
+    } else if (protocol_deserialize_action_message(
+                   buf, len, client->version, &action, &sequence, &tick) < 0) {
+        return -1;
+    }
+
+    if (client->version >= PROTOCOL_VERSION_SEQUENCED) {
+        if (sequence <= client->sequence) {
+            printf("[INFO] Stale command %u from player-%ld (last %u), "
+                   "ignored\n",
+                   sequence, index, client->sequence);
+            return 0;
+        }
+        client->sequence = sequence;
+        client->ticks    = 0;
+    }
+    // A fire of this command is checked against what the player saw
+    game_state.players[index].view_tick = tick;
+
+    if (is_input) {
+        printf("[INFO] Received input 0x%02x from player-%ld (%ld bytes)\n",
+               input, index, len);
+        game_state_set_input(&game_state, index, input);
+        metrics.actions++;
+        return 0;
+    }
+
+    printf("[INFO] Received an action %s from player-%ld (%ld bytes)\n",
+           str_action(action), index, len);
+    game_state_update_tank(&game_state, index, action);
+    metrics.actions++;
+    printf("[INFO] Updating game state completed\n");
+    return 0;
+}
+
+// Lag compensation costs so far: the history is a fixed size, each tick
+// records it once and each fire rewinds at most REWIND_MAX_TICKS of it
+static void report_history(void)
+{
+    const History_Stats *stats = &history.stats;
+    printf("[INFO] Lag compensation: %zu bytes of history, %llu rewinds, "
+           "%.1f ticks avg, %u max, %llu hits\n",
+           sizeof(history), (unsigned long long)stats->rewinds,
+           stats->rewinds ? (double)stats->rewound_ticks / stats->rewinds : 0.0,
+           stats->max_rewound_ticks, (unsigned long long)stats->hits);
+}
+
+/*
+ * Applies every complete frame buffered for a player, a frame split across
+ * reads waits in the reader for the rest. A frame that can't be decoded, or
+ * a length that can't be a frame, drops the player, the stream can't be
+ * trusted after that.
+ */
+static void handle_frames(Connection *client, size_t index)
+{
+    const unsigned char *frame;
+    ssize_t len;
+
+    while ((len = network_reader_next(&client->reader, &frame)) > 0) {
+        bool hello    = protocol_is_hello(frame, len);
+        uint64_t span = profiler_begin();
+        int err       = hello ? handshake(client, frame, len, index)
+                              : handle_message(client, frame, len, index);
+        profiler_end(PHASE_APPLY, index, span);
+
+        if (err == REPLY_UNSENT) {
+            drop_client(client, index, send_failure());
+            printf("[INFO] Reply to player-%zu not sent whole, dropped\n",
+                   index);
+            return;
+        }
+        if (err < 0) {
+            drop_client(client, index, DROP_MALFORMED);
+            printf("[INFO] Malformed frame from player-%zu, dropped\n",
+                   index);
+            return;
+        }
+        if (hello)
+            printf("[INFO] Player-%zu handshake completed (version %u, "
+                   "caps 0x%x)\n",
+                   index, client->version, client->caps);
+    }
+
+    if (len < 0) {
+        drop_client(client, index, DROP_MALFORMED);
+        printf("[INFO] Bad frame length from player-%zu, dropped\n", index);
+    }
+}
+
+// Players seated and entities alive as of the last broadcast
+static void read_gauges(const Connection *clients, Metrics_Gauges *gauges)
+{
+    memset(gauges, 0x00, sizeof(*gauges));
+    for (int i = 0; i < MAX_PLAYERS; i++)
+        if (clients[i].fd >= 0) gauges->players++;
+    for (Entity_Kind kind = ENTITY_TANK; kind < ENTITY_KINDS; ++kind)
+        for (size_t slot = 0; slot < entity_table_slots(kind); ++slot)
+            if (entity_table_get(&entities, kind, slot))
+                gauges->entities[kind]++;
+}
+
+static void on_signal(int signum)
+{
+    if (signum == SIGUSR1)
+        toggle_profiler = 1;
+    else if (signum == SIGUSR2)
+        dump_profiler = 1;
+    else
+        running = 0;
+}
+
+// Tick phase histograms on stdout and the trace of the latest spans
+static void dump_profile(void)
+{
+    if (!profiler_has_spans()) return;
+    profiler_print_histograms(stdout);
+    if (profiler_write_trace(TRACE_PATH) < 0)
+        perror("profiler_write_trace() error");
+    else
+        printf("[INFO] Tick phases trace written to %s\n", TRACE_PATH);
+}
+
+/*
+ * Seats a new connection in the first free slot, spawns its tank and sends
+ * it the game state. Returns -1 if it was refused or couldn't be synced.
+ */
+static int accept_player(int server_fd, Connection *clients, unsigned char *buf)
+{
+    int i;
+    int client_fd = server_accept(server_fd);
+    if (client_fd < 0) {
+        perror("accept() error");
+        return -1;
+    }
+
+    for (i = 0; i < MAX_PLAYERS; i++) {
+        if (clients[i].fd < 0) {
+            // Every client starts as legacy until it says hello
+            clients[i].fd           = client_fd;
+            clients[i].version      = PROTOCOL_VERSION_LEGACY;
+            clients[i].caps         = 0;
+            clients[i].sequence     = 0;
+            clients[i].ticks        = 0;
+            clients[i].reader.start = 0;
+            clients[i].reader.end   = 0;
+            game_state.player_index = i;
+            break;
+        }
+    }
+
+    if (i == MAX_PLAYERS) {
+        printf("[INFO] Players limit reached, dropping connection\n");
+        close(client_fd);
+        metrics.rejected++;
+        return -1;
+    }
+    metrics.connections++;
+
+    printf("[INFO] New player connected\n");
+    printf("[INFO] Syncing game state\n");
+    printf("[INFO] Player assigned [%ld] tank\n", game_state.player_index);
+
+    // Spawn a tank in a random position for the new connected player
+    game_state_spawn_tank(&game_state, game_state.player_index);
+    printf("[INFO] Tank for player-%ld spawned\n", game_state.player_index);
+
+    // Send the game state, versioned clients skip it until the handshake is
+    // done
+    ssize_t bytes = protocol_serialize_game_state(&game_state, buf);
+    if (send_to(client_fd, buf, bytes) != bytes) {
+        drop_client(&clients[i], i, send_failure());
+        printf("[INFO] Game state sync to player-%d not sent whole, dropped\n",
+               i);
+        return -1;
+    }
+    printf("[INFO] Game state sync completed (%ld bytes)\n", bytes);
+    return 0;
+}
+
 static unsigned long long get_microseconds_timestamp(void)
 {
     struct timespec ts;
@@ -157,32 +581,48 @@ static unsigned long long get_microseconds_timestamp(void)
     return (unsigned long long)(ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
 }
 
-static void server_loop(int server_fd)
+static void server_loop(int server_fd, int metrics_fd)
 {
     fd_set readfds;
-    int client_fds[FD_SETSIZE];
-    int maxfd = server_fd;
-    int i     = 0;
+    Connection clients[MAX_PLAYERS];
+    int maxfd     = server_fd > metrics_fd ? server_fd : metrics_fd;
+    int scrape_fd = -1;
+    int i         = 0;
     unsigned char buf[BUFSIZE];
     struct timeval tv                  = {0, TIMEOUT};
     size_t spawn_counter               = 0;
+    size_t report_counter              = 0;
     unsigned long long current_time_ns = 0, remaining_us = 0,
                        last_update_time_ns = 0;
 
-    // Initialize client_fds array
-    for (i = 0; i < FD_SETSIZE; i++) {
-        client_fds[i] = -1;
+    // Initialize clients array
+    for (i = 0; i < MAX_PLAYERS; i++) {
+        clients[i].fd = -1;
     }
 
-    while (1) {
+    while (running) {
+        if (toggle_profiler) {
+            toggle_profiler  = 0;
+            profiler_enabled = !profiler_enabled;
+            printf("[INFO] Tick phases profiler %s\n",
+                   profiler_enabled ? "on" : "off");
+        }
+        if (dump_profiler) {
+            dump_profiler = 0;
+            dump_profile();
+        }
+
         FD_ZERO(&readfds);
         FD_SET(server_fd, &readfds);
-
-        for (i = 0; i < FD_SETSIZE; i++) {
-            if (client_fds[i] >= 0) {
-                FD_SET(client_fds[i], &readfds);
-                if (client_fds[i] > maxfd) {
-                    maxfd = client_fds[i];
+        if (metrics_fd >= 0) FD_SET(metrics_fd, &readfds);
+        if (scrape_fd >= 0) FD_SET(scrape_fd, &readfds);
+        if (scrape_fd > maxfd) maxfd = scrape_fd;
+
+        for (i = 0; i < MAX_PLAYERS; i++) {
+            if (clients[i].fd >= 0) {
+                FD_SET(clients[i].fd, &readfds);
+                if (clients[i].fd > maxfd) {
+                    maxfd = clients[i].fd;
                 }
             }
         }
@@ -191,80 +631,49 @@ static void server_loop(int server_fd)
 
         int num_events = select(maxfd + 1, &readfds, NULL, NULL, &tv);
 
+        if (num_events == -1 && errno == EINTR) continue;
         if (num_events == -1) {
             perror("select() error");
             exit(EXIT_FAILURE);
         }
 
+        // One scrape at a time, a newer one replaces a scraper gone silent
+        if (scrape_fd >= 0 && FD_ISSET(scrape_fd, &readfds)) {
+            Metrics_Gauges gauges;
+            read_gauges(clients, &gauges);
+            metrics_respond(scrape_fd, &metrics, &gauges);
+            scrape_fd = -1;
+        }
+        if (metrics_fd >= 0 && FD_ISSET(metrics_fd, &readfds)) {
+            if (scrape_fd >= 0) close(scrape_fd);
+            scrape_fd = metrics_accept(metrics_fd);
+        }
+
         if (FD_ISSET(server_fd, &readfds)) {
             // New connection request
-            int client_fd = server_accept(server_fd);
-            if (client_fd < 0) {
-                perror("accept() error");
-                continue;
-            }
-
-            for (i = 0; i < FD_SETSIZE; i++) {
-                if (client_fds[i] < 0) {
-                    if (i > MAX_PLAYERS) {
-                        printf(
-                            "[INFO] Players limit reached, dropping "
-                            "connection");
-                        i = FD_SETSIZE;
-                        break;
-                    }
-                    client_fds[i]           = client_fd;
-                    game_state.player_index = i;
-                    break;
-                }
-            }
-
-            if (i == FD_SETSIZE) {
-                fprintf(stderr, "Too many clients\n");
-                close(client_fd);
-                continue;
-            }
-
-            printf("[INFO] New player connected\n");
-            printf("[INFO] Syncing game state\n");
-            printf("[INFO] Player assigned [%ld] tank\n",
-                   game_state.player_index);
-
-            // Spawn a tank in a random position for the new connected
-            // player
-            game_state_spawn_tank(&game_state, game_state.player_index);
-            printf("[INFO] Tank for player-%ld spawned\n",
-                   game_state.player_index);
-
-            // Send the game state
-            ssize_t bytes = protocol_serialize_game_state(&game_state, buf);
-            bytes         = network_send(client_fd, buf, bytes);
-            if (bytes < 0) {
-                perror("network_send() error");
-                continue;
-            }
-            printf("[INFO] Game state sync completed (%ld bytes)\n", bytes);
+            uint64_t span = profiler_begin();
+            int accepted  = accept_player(server_fd, clients, buf);
+            profiler_end(PHASE_ACCEPT, -1, span);
+            if (accepted < 0) continue;
         }
 
-        for (i = 0; i < FD_SETSIZE; i++) {
-            int fd = client_fds[i];
+        for (i = 0; i < MAX_PLAYERS; i++) {
+            int fd = clients[i].fd;
             if (fd >= 0 && FD_ISSET(fd, &readfds)) {
-                ssize_t count = network_recv(fd, buf);
+                uint64_t span = profiler_begin();
+                ssize_t count = network_reader_fill(fd, &clients[i].reader);
+                profiler_end(PHASE_READ, i, span);
+                if (count > 0) metrics.bytes_in += count;
+                // Nothing to read after all isn't a reason to let go
+                if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+                                  errno == EINTR))
+                    continue;
                 if (count <= 0) {
-                    close(fd);
-                    game_state_dismiss_tank(&game_state, i);
-                    client_fds[i] = -1;
+                    drop_client(&clients[i], i, DROP_DISCONNECTED);
                     printf("[INFO] Player-%d disconnected\n", i);
-                } else {
-                    unsigned action = IDLE;
-                    protocol_deserialize_action(buf, &action);
-                    printf(
-                        "[INFO] Received an action %s from player-%d (%ld "
-                        "bytes)\n",
-                        str_action(action), i, count);
-                    game_state_update_tank(&game_state, i, action);
-                    printf("[INFO] Updating game state completed\n");
+                    continue;
                 }
+                handle_frames(&clients[i], i);
             }
         }
         // Poor man periodic task
@@ -282,17 +691,37 @@ static void server_loop(int server_fd)
         remaining_us    = current_time_ns - last_update_time_ns;
         if (remaining_us >= TIMEOUT) {
             // Main update loop here
+            uint64_t tick_span = profiler_begin();
+            uint64_t span      = profiler_begin();
             game_state_update(&game_state);
-            size_t bytes = protocol_serialize_game_state(&game_state, buf);
-            broadcast(client_fds, buf, bytes);
+            profiler_end(PHASE_UPDATE, -1, span);
+            // Lets clients tell how long their held input has been applied
+            for (i = 0; i < MAX_PLAYERS; i++) clients[i].ticks++;
+            span = profiler_begin();
+            broadcast(clients, &game_state);
+            profiler_end(PHASE_BROADCAST, -1, span);
+            profiler_end(PHASE_TICK, -1, tick_span);
+            if (++report_counter >= HISTORY_REPORT) {
+                report_counter = 0;
+                report_history();
+            }
+            // A tick started a whole period late means one was skipped
+            if (metrics.ticks > 0 && remaining_us >= 2 * TIMEOUT)
+                metrics.overruns++;
             last_update_time_ns = get_microseconds_timestamp();
-            tv.tv_sec           = 0;
-            tv.tv_usec          = TIMEOUT;
+            metrics_observe_tick(&metrics,
+                                 (last_update_time_ns - current_time_ns) / 1e6);
+            tv.tv_sec  = 0;
+            tv.tv_usec = TIMEOUT;
         } else {
             tv.tv_sec  = 0;
             tv.tv_usec = TIMEOUT - remaining_us;
         }
     }
+
+    for (i = 0; i < MAX_PLAYERS; i++)
+        if (clients[i].fd >= 0) close(clients[i].fd);
+    if (scrape_fd >= 0) close(scrape_fd);
 }
 
 int main(void)
@@ -301,11 +730,36 @@ int main(void)
 
     printf("[INFO] Starting server\n");
     game_state_init(&game_state);
+    tank_history_init(&history);
+    game_state.history = &history;
 
     int server_fd = server_listen("127.0.0.1", 6699, BACKLOG);
     if (server_fd < 0) exit(EXIT_FAILURE);
 
-    server_loop(server_fd);
+    // A clean exit flushes the profile of instrumented builds, see make pgo
+    struct sigaction action = {.sa_handler = on_signal};
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    sigaction(SIGUSR1, &action, NULL);
+    sigaction(SIGUSR2, &action, NULL);
+    profiler_enabled = getenv("BATTLETANK_PROFILE") != NULL;
+
+    // Optional, the game goes on without it
+    int metrics_fd = metrics_listen(METRICS_PATH);
+    if (metrics_fd < 0)
+        perror("metrics_listen() error");
+    else
+        printf("[INFO] Metrics served on %s\n", METRICS_PATH);
+
+    server_loop(server_fd, metrics_fd);
+
+    printf("[INFO] Shutting down\n");
+    close(server_fd);
+    if (metrics_fd >= 0) {
+        close(metrics_fd);
+        unlink(METRICS_PATH);
+    }
+    dump_profile();
 
     return 0;
 }
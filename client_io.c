@@ -0,0 +1,302 @@
+#include "client_io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "network.h"
+
+// The middle slot index is packed with a flag set by the writer on publish
+// and cleared by the reader on acquire
+#define SLOT_MASK  0x3u
+#define SLOT_FRESH 0x4u
+
+double client_io_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void snapshot_buffer_init(Snapshot_Buffer *buffer)
+{
+    buffer->front = 0;
+    buffer->back  = 1;
+    atomic_init(&buffer->middle, 2);
+}
+
+// Hands the back slot over to the reader, the old middle one becomes the
+// back slot to fill next
+static void snapshot_buffer_publish(Snapshot_Buffer *buffer)
+{
+    unsigned old = atomic_exchange_explicit(
+        &buffer->middle, buffer->back | SLOT_FRESH, memory_order_acq_rel);
+    buffer->back = old & SLOT_MASK;
+}
+
+// Takes the middle slot if something was published since the last call, the
+// front slot stays untouched by the writer until the next successful one
+static bool snapshot_buffer_acquire(Snapshot_Buffer *buffer)
+{
+    if (!(atomic_load_explicit(&buffer->middle, memory_order_relaxed) &
+          SLOT_FRESH))
+        return false;
+    unsigned old = atomic_exchange_explicit(&buffer->middle, buffer->front,
+                                            memory_order_acq_rel);
+    buffer->front = old & SLOT_MASK;
+    return true;
+}
+
+static bool command_queue_push(Command_Queue *queue,
+                               const Client_Command *command)
+{
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+    if (tail - head == CLIENT_IO_QUEUE) return false;
+
+    queue->commands[tail % CLIENT_IO_QUEUE] = *command;
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+static bool command_queue_pop(Command_Queue *queue, Client_Command *command)
+{
+    size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+    if (head == tail) return false;
+
+    *command = queue->commands[head % CLIENT_IO_QUEUE];
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+    return true;
+}
+
+// A frame cut short by a full socket buffer can't be finished later without
+// queuing it, a server that far behind is as good as gone
+static int send_frame(Client_IO *io, const unsigned char *buf, size_t len)
+{
+    if (network_send(io->sockfd, buf, len) < (ssize_t)len) return -1;
+    io->stats.bytes_out += len;
+    return 0;
+}
+
+static int send_command(Client_IO *io, const Client_Command *command)
+{
+    unsigned char buf[CLIENT_IO_BUFSIZE];
+    int n = client_session_encode(&io->session, command, buf);
+    return send_frame(io, buf, n);
+}
+
+// Stamped with the clock in us, wrapping is fine as long as a round trip
+// takes less than an hour
+static uint32_t ping_stamp(double now) { return (uint64_t)(now * 1e6); }
+
+/*
+ * Runs every CLIENT_IO_PERIOD: sends a ping if the server answers them and
+ * summarizes the stats, published along with the next snapshots.
+ */
+static int run_period(Client_IO *io, double now)
+{
+    unsigned char buf[CLIENT_IO_BUFSIZE];
+    Net_Stats *stats = &io->stats;
+    float elapsed    = now - stats->summarized_at;
+
+    stats_ring_summarize(&stats->arrivals, &io->summary.arrivals);
+    stats_ring_summarize(&stats->decode, &io->summary.decode);
+    stats_ring_summarize(&stats->rtt, &io->summary.rtt);
+    io->summary.bytes_in  = stats->bytes_in / elapsed;
+    io->summary.bytes_out = stats->bytes_out / elapsed;
+    stats->bytes_in       = 0;
+    stats->bytes_out      = 0;
+    stats->summarized_at  = now;
+
+    if (!(io->session.hello.caps & CAP_PING)) return 0;
+    int n = protocol_serialize_ping(MSG_PING, ping_stamp(now), buf);
+    return send_frame(io, buf, n);
+}
+
+static void handle_pong(Client_IO *io, const unsigned char *buf, size_t len,
+                        double received_at)
+{
+    uint32_t stamp;
+    if (protocol_deserialize_ping(buf, len, MSG_PONG, &stamp) < 0) return;
+    uint32_t rtt = ping_stamp(received_at) - stamp;
+    stats_ring_push(&io->stats.rtt, rtt / 1e3f);
+}
+
+/*
+ * Handles a frame received, entity events update the handle table, pongs
+ * the round trip stats, snapshots are decompressed if needed, decoded in the
+ * back slot of the triple buffer and published. Malformed frames are just
+ * dropped.
+ */
+static void handle_frame(Client_IO *io, const unsigned char *buf, size_t len,
+                         double received_at)
+{
+    Client_Snapshot *snapshot = &io->snapshots.slots[io->snapshots.back];
+    unsigned version          = io->session.hello.version;
+
+    if (len <= sizeof(int)) return;
+    if (version != PROTOCOL_VERSION_LEGACY &&
+        protocol_message_type(buf, len) == MSG_PONG) {
+        handle_pong(io, buf, len, received_at);
+        return;
+    }
+    double decode_start = client_io_now();
+    int n = client_session_decode(&io->session, buf, len, snapshot->frame,
+                                  sizeof(snapshot->frame), &snapshot->view);
+    if (n <= 0) return;
+
+    // Only sessions carrying the server tick interpolate the full state
+    if (version >= PROTOCOL_VERSION_SEQUENCED)
+        protocol_deserialize_snapshot(snapshot->frame, n, version,
+                                      &snapshot->state);
+    // Timed per frame, not from the read, the frames of a read would count
+    // the decoding of the ones before them
+    Net_Stats *stats = &io->stats;
+    stats_ring_push(&stats->decode, (client_io_now() - decode_start) * 1e6);
+
+    snapshot->len         = n;
+    snapshot->entities    = io->session.entities;
+    snapshot->received_at = received_at;
+    if (stats->last_arrival > 0.0)
+        stats_ring_push(&stats->arrivals,
+                        (received_at - stats->last_arrival) * 1e3);
+    stats->last_arrival = received_at;
+    snapshot->net       = io->summary;
+
+    snapshot_buffer_publish(&io->snapshots);
+}
+
+/*
+ * Reads what's on the socket and handles every complete frame, a partial
+ * one waits for the next read. Returns -1 once the connection is gone or
+ * the stream can't be trusted anymore, a read finding nothing is fine.
+ */
+static int receive_frames(Client_IO *io)
+{
+    const unsigned char *frame;
+
+    ssize_t n = network_reader_fill(io->sockfd, &io->reader);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return 0;
+    if (n <= 0) return -1;
+    double received_at  = client_io_now();
+    io->stats.bytes_in += n;
+
+    while ((n = network_reader_next(&io->reader, &frame)) > 0)
+        handle_frame(io, frame, n, received_at);
+
+    return n < 0 ? -1 : 0;
+}
+
+static void *client_io_run(void *arg)
+{
+    Client_IO *io = arg;
+    Client_Command command;
+    unsigned char drain[64];
+    struct pollfd fds[2] = {{.fd = io->sockfd, .events = POLLIN},
+                            {.fd = io->wakeup[0], .events = POLLIN}};
+
+    while (atomic_load(&io->running)) {
+        // Wakes up in time for the next period at the latest
+        double now = client_io_now();
+        double due = io->stats.summarized_at + CLIENT_IO_PERIOD;
+        if (now >= due) {
+            if (run_period(io, now) < 0) goto err;
+            due = now + CLIENT_IO_PERIOD;
+        }
+        if (poll(fds, 2, (due - now) * 1000 + 1) < 0) {
+            if (errno == EINTR) continue;
+            goto err;
+        }
+        if (fds[1].revents & POLLIN)
+            while (read(io->wakeup[0], drain, sizeof(drain)) > 0)
+                ;
+        while (command_queue_pop(&io->commands, &command))
+            if (send_command(io, &command) < 0) goto err;
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR))
+            if (receive_frames(io) < 0) goto err;
+    }
+
+    return NULL;
+
+err:
+
+    atomic_store(&io->closed, true);
+    return NULL;
+}
+
+/*
+ * Hands the socket over to a new I/O thread, the handshake must be done
+ * already: `session` is the agreed one and decides how frames are encoded
+ * and decoded from now on. The socket is made non-blocking, it stays open on
+ * stop, it's up to the caller to close it.
+ */
+int client_io_start(Client_IO *io, int sockfd, const Hello *session)
+{
+    int flags = fcntl(sockfd, F_GETFL, 0);
+    if (flags < 0 || fcntl(sockfd, F_SETFL, flags | O_NONBLOCK) < 0)
+        return -1;
+
+    io->sockfd       = sockfd;
+    io->reader.start = 0;
+    io->reader.end   = 0;
+    client_session_init(&io->session, session);
+    memset(&io->stats, 0x00, sizeof(io->stats));
+    memset(&io->summary, 0x00, sizeof(io->summary));
+    io->stats.summarized_at = client_io_now();
+    snapshot_buffer_init(&io->snapshots);
+    atomic_init(&io->commands.head, 0);
+    atomic_init(&io->commands.tail, 0);
+    atomic_init(&io->running, true);
+    atomic_init(&io->closed, false);
+
+    if (pipe(io->wakeup) < 0) return -1;
+    // The thread drains the pipe until empty and a full pipe already means
+    // a wakeup pending, neither end must block
+    for (int i = 0; i < 2; ++i)
+        if (fcntl(io->wakeup[i], F_SETFL, O_NONBLOCK) < 0) goto err;
+    if (pthread_create(&io->thread, NULL, client_io_run, io) != 0) goto err;
+
+    return 0;
+
+err:
+
+    close(io->wakeup[0]);
+    close(io->wakeup[1]);
+    return -1;
+}
+
+void client_io_stop(Client_IO *io)
+{
+    atomic_store(&io->running, false);
+    (void)!write(io->wakeup[1], "", 1);
+    pthread_join(io->thread, NULL);
+    close(io->wakeup[0]);
+    close(io->wakeup[1]);
+}
+
+// Queues a command for the I/O thread, false if the queue is full, in which
+// case nothing is sent
+bool client_io_send(Client_IO *io, const Client_Command *command)
+{
+    if (!command_queue_push(&io->commands, command)) return false;
+    (void)!write(io->wakeup[1], "", 1);
+    return true;
+}
+
+// Newest snapshot if one arrived since the last call, NULL otherwise. The
+// snapshot returned stays valid until the next call returning non-NULL.
+const Client_Snapshot *client_io_latest(Client_IO *io)
+{
+    if (!snapshot_buffer_acquire(&io->snapshots)) return NULL;
+    return &io->snapshots.slots[io->snapshots.front];
+}
+
+bool client_io_closed(const Client_IO *io)
+{
+    return atomic_load(&io->closed);
+}
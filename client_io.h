@@ -0,0 +1,113 @@
+#ifndef CLIENT_IO_H
+#define CLIENT_IO_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "client_session.h"
+#include "game_state.h"
+#include "network.h"
+#include "protocol.h"
+#include "stats.h"
+
+#define CLIENT_IO_BUFSIZE CLIENT_SESSION_BUFSIZE
+// Commands waiting to be sent, the I/O thread drains them as soon as they're
+// queued so a handful is plenty
+#define CLIENT_IO_QUEUE   64
+// Seconds between two pings, the network stats are summarized as often
+#define CLIENT_IO_PERIOD  1.0
+
+// Network side of the performance overlay as of the last summary: time
+// between snapshots (ms, its stddev is the jitter), time to decode one (us),
+// ping round trips (ms) and bytes per second on the wire both ways
+typedef struct {
+    Stats_Summary arrivals;
+    Stats_Summary decode;
+    Stats_Summary rtt;
+    float bytes_in;
+    float bytes_out;
+} Net_Summary;
+
+// Raw measures behind Net_Summary, touched by the I/O thread only, byte
+// counts are reset at every summary
+typedef struct {
+    Stats_Ring arrivals;
+    Stats_Ring decode;
+    Stats_Ring rtt;
+    size_t bytes_in;
+    size_t bytes_out;
+    double last_arrival;
+    double summarized_at;
+} Net_Stats;
+
+/*
+ * Last snapshot received, decoded by the I/O thread: the raw frame with a
+ * view over it, the full game state when the session carries the server tick
+ * (interpolation needs it), the handles of the live entities as of that
+ * snapshot, the time it was received, on the client_io_now clock, and the
+ * latest network stats.
+ */
+typedef struct {
+    unsigned char frame[CLIENT_IO_BUFSIZE];
+    size_t len;
+    Snapshot_View view;
+    Game_State state;
+    Entity_Table entities;
+    double received_at;
+    Net_Summary net;
+} Client_Snapshot;
+
+/*
+ * Triple buffer, the writer fills its back slot and swaps it with the middle
+ * one, the reader swaps the middle one with its front slot when flagged as
+ * fresh. Neither side ever waits and the reader always gets the newest
+ * snapshot, older ones not picked up in time are overwritten.
+ */
+typedef struct {
+    Client_Snapshot slots[3];
+    atomic_uint middle;
+    unsigned back;
+    unsigned front;
+} Snapshot_Buffer;
+
+// Single producer single consumer ring, head is written by the consumer
+// only, tail by the producer only
+typedef struct {
+    Client_Command commands[CLIENT_IO_QUEUE];
+    atomic_size_t head;
+    atomic_size_t tail;
+} Command_Queue;
+
+/*
+ * Network side of the client: once the handshake is done the I/O thread owns
+ * the socket, it sends the queued commands, decodes the snapshots and entity
+ * events received and publishes the latest snapshot. The render loop only
+ * touches the two lock-free ends and never blocks on the socket, nor does
+ * the thread, the socket is non-blocking and frames split across reads wait
+ * in `reader` for the rest.
+ */
+typedef struct {
+    int sockfd;
+    Client_Session session;
+    Frame_Reader reader;
+    Snapshot_Buffer snapshots;
+    Command_Queue commands;
+    Net_Stats stats;
+    Net_Summary summary;
+    // Written to wake the thread up when a command is queued or on stop
+    int wakeup[2];
+    atomic_bool running;
+    atomic_bool closed;
+    pthread_t thread;
+} Client_IO;
+
+double client_io_now(void);
+int client_io_start(Client_IO *io, int sockfd, const Hello *session);
+void client_io_stop(Client_IO *io);
+bool client_io_send(Client_IO *io, const Client_Command *command);
+const Client_Snapshot *client_io_latest(Client_IO *io);
+bool client_io_closed(const Client_IO *io);
+
+#endif
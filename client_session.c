@@ -0,0 +1,232 @@
+#include "client_session.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "network.h"
+
+int client_session_connect(const char *host, int port)
+{
+    int s, retval = -1;
+    struct addrinfo *servinfo, *p;
+    struct timeval tv           = {0, CLIENT_SESSION_TIMEOUT};
+    const struct addrinfo hints = {.ai_family   = AF_UNSPEC,
+                                   .ai_socktype = SOCK_STREAM,
+                                   .ai_flags    = AI_PASSIVE};
+
+    char port_string[6];
+    snprintf(port_string, sizeof(port_string), "%d", port);
+
+    if (getaddrinfo(host, port_string, &hints, &servinfo) != 0) return -1;
+
+    for (p = servinfo; p != NULL; p = p->ai_next) {
+        /* Try to create the socket and to connect it.
+         * If we fail in the socket() call, or on connect(), we retry with
+         * the next entry in servinfo. */
+        if ((s = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1)
+            continue;
+
+        // Bounds the connect, the socket doesn't block afterwards
+        setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(struct timeval));
+
+        /* Try to connect. */
+        if (connect(s, p->ai_addr, p->ai_addrlen) == -1) {
+            close(s);
+            break;
+        }
+
+        int flags = fcntl(s, F_GETFL, 0);
+        if (flags < 0 || fcntl(s, F_SETFL, flags | O_NONBLOCK) < 0) {
+            close(s);
+            break;
+        }
+
+        /* If we ended an iteration of the for loop without errors, we
+         * have a connected socket. Let's return to the caller. */
+        retval = s;
+        break;
+    }
+
+    freeaddrinfo(servinfo);
+    return retval; /* Will be -1 if no connection succeeded. */
+}
+
+static long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Waits until the socket is readable or `timeout` ms are gone, returns 1,
+// 0 on timeout or -1 on errors
+static int wait_readable(int sockfd, long timeout)
+{
+    struct pollfd pfd = {.fd = sockfd, .events = POLLIN};
+    if (timeout < 0) timeout = 0;
+
+    int n = poll(&pfd, 1, timeout);
+    if (n < 0 && errno == EINTR) return 0;
+    return n < 0 ? -1 : n > 0;
+}
+
+/*
+ * Reads exactly `count` bytes, never a byte past them, whatever follows is
+ * left on the socket for the I/O thread. A peer that stops sending midway
+ * for CLIENT_SESSION_WAIT fails with ETIMEDOUT. Returns 0 once all of them
+ * are in, -1 otherwise.
+ */
+static int read_exactly(int sockfd, unsigned char *buf, size_t count)
+{
+    size_t received = 0;
+
+    while (received < count) {
+        ssize_t n = read(sockfd, buf + received, count - received);
+        if (n > 0) {
+            received += n;
+            continue;
+        }
+        if (n == 0) {
+            errno = ECONNRESET;
+            return -1;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            return -1;
+
+        int ready = wait_readable(sockfd, CLIENT_SESSION_WAIT);
+        if (ready < 0) return -1;
+        if (ready == 0) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Opens the session with a hello advertising the protocol version and the
+ * capabilities `caps`, frames preceding the reply (the legacy sync the
+ * server sends to every new connection) are skipped. A server not answering
+ * within CLIENT_SESSION_WAIT predates the handshake, in which case the player
+ * index is taken from the legacy sync received meanwhile. Frames are read
+ * whole, one at a time, the ones following the reply stay on the socket.
+ * Returns -1 if the socket fails, `agreed` is the legacy protocol then.
+ */
+int client_session_handshake(int sockfd, unsigned caps, Hello *agreed)
+{
+    unsigned char buf[CLIENT_SESSION_BUFSIZE];
+    Snapshot_View view;
+    bool synced       = false;
+    const Hello hello = {.version = PROTOCOL_VERSION, .caps = caps};
+
+    agreed->version      = PROTOCOL_VERSION_LEGACY;
+    agreed->caps         = 0;
+    agreed->player_index = 0;
+
+    ssize_t n            = protocol_serialize_hello(&hello, buf);
+    if (network_send(sockfd, buf, n) < n) return -1;
+
+    // The fallback is only taken between two frames, never midway one
+    long deadline = now_ms() + CLIENT_SESSION_WAIT;
+    while (now_ms() < deadline) {
+        int ready = wait_readable(sockfd, deadline - now_ms());
+        if (ready < 0) return -1;
+        if (ready == 0) continue;
+
+        if (read_exactly(sockfd, buf, sizeof(int)) < 0) return -1;
+        n = bin_read_i32(buf);
+        if (n < (ssize_t)sizeof(int) || n > (ssize_t)sizeof(buf)) {
+            errno = EMSGSIZE;
+            return -1;
+        }
+        if (read_exactly(sockfd, buf + sizeof(int), n - sizeof(int)) < 0)
+            return -1;
+
+        if (protocol_deserialize_hello(buf, n, agreed) > 0) return 0;
+        // Only the first sync carries our index, broadcasts carry the index
+        // of the last player connected
+        if (!synced &&
+            protocol_snapshot_view(buf, n, PROTOCOL_VERSION_LEGACY, &view) == 0) {
+            agreed->player_index = snapshot_view_player_index(&view);
+            synced               = true;
+        }
+    }
+
+    return 0;
+}
+
+void client_session_init(Client_Session *session, const Hello *agreed)
+{
+    session->hello = *agreed;
+    memset(&session->entities, 0x00, sizeof(session->entities));
+    compress_context_init(&session->compress);
+}
+
+// Frame of the command in the encoding of the session, returns its length
+int client_session_encode(const Client_Session *session,
+                          const Client_Command *command, unsigned char *buf)
+{
+    unsigned version = session->hello.version;
+
+    if (command->kind == CLIENT_COMMAND_INPUT)
+        return protocol_serialize_input(command->value, version,
+                                        command->sequence, command->tick, buf);
+    if (version == PROTOCOL_VERSION_LEGACY)
+        return protocol_serialize_action(command->value, buf);
+    return protocol_serialize_action_message(
+        command->value, version, command->sequence, command->tick, buf);
+}
+
+// Keeps the handles of the live entities up to date, per-entity client state
+// is keyed on them and stays valid across players leaving and joining
+static int apply_entity_events(Entity_Table *entities,
+                               const unsigned char *buf, size_t len)
+{
+    Entity_Event events[ENTITY_EVENTS_MAX];
+    size_t count = 0;
+    if (protocol_deserialize_entity_events(buf, len, events, &count) < 0)
+        return -1;
+    for (size_t i = 0; i < count; ++i) entity_table_apply(entities, &events[i]);
+    return 0;
+}
+
+/*
+ * Decodes a frame received on the session: entity events update the handle
+ * table, snapshots are decompressed if needed into `frame`, `capacity` bytes
+ * long, and `view` set over it. Returns the length of the snapshot in
+ * `frame`, 0 for any other frame, which is left to the caller, -1 if the
+ * frame is malformed.
+ */
+int client_session_decode(Client_Session *session, const unsigned char *buf,
+                          size_t len, unsigned char *frame, size_t capacity,
+                          Snapshot_View *view)
+{
+    unsigned version  = session->hello.version;
+    Message_Type type = version == PROTOCOL_VERSION_LEGACY
+                            ? MSG_SNAPSHOT
+                            : protocol_message_type(buf, len);
+    int n             = len;
+
+    if (type == MSG_ENTITY_EVENTS)
+        return apply_entity_events(&session->entities, buf, len);
+    if (type == MSG_SNAPSHOT_COMPRESSED) {
+        n = protocol_decompress_snapshot(&session->compress, buf, len, frame,
+                                         capacity);
+        if (n <= 0) return -1;
+    } else if (type == MSG_SNAPSHOT && len <= capacity) {
+        memcpy(frame, buf, len);
+    } else {
+        return type == MSG_SNAPSHOT ? -1 : 0;
+    }
+
+    if (protocol_snapshot_view(frame, n, version, view) < 0) return -1;
+    return n;
+}
@@ -0,0 +1,50 @@
+#ifndef CLIENT_SESSION_H
+#define CLIENT_SESSION_H
+
+#include <stdint.h>
+
+#include "compress.h"
+#include "game_state.h"
+#include "protocol.h"
+
+#define CLIENT_SESSION_BUFSIZE  2048
+// Timeout of the blocking connect, in us
+#define CLIENT_SESSION_TIMEOUT  10000
+// Time to wait for the hello reply before falling back to the legacy
+// protocol, and for the rest of a frame once it started coming, in ms
+#define CLIENT_SESSION_WAIT     1000
+
+typedef enum { CLIENT_COMMAND_ACTION, CLIENT_COMMAND_INPUT } Client_Command_Kind;
+
+// `tick` is the one of the game state on screen when the command was issued
+typedef struct {
+    Client_Command_Kind kind;
+    unsigned value;
+    uint32_t sequence;
+    uint32_t tick;
+} Client_Command;
+
+/*
+ * Client end of a connection once the handshake is done, without any
+ * rendering nor threading attached: the settings agreed with the server,
+ * which decide how frames are encoded and decoded, the compression history
+ * and the handles of the live entities as of the last frame decoded.
+ */
+typedef struct {
+    Hello hello;
+    Compress_Context compress;
+    Entity_Table entities;
+} Client_Session;
+
+// Setup, the socket returned is non-blocking once connected
+int client_session_connect(const char *host, int port);
+int client_session_handshake(int sockfd, unsigned caps, Hello *agreed);
+
+void client_session_init(Client_Session *session, const Hello *agreed);
+int client_session_encode(const Client_Session *session,
+                          const Client_Command *command, unsigned char *buf);
+int client_session_decode(Client_Session *session, const unsigned char *buf,
+                          size_t len, unsigned char *frame, size_t capacity,
+                          Snapshot_View *view);
+
+#endif
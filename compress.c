@@ -0,0 +1,107 @@
+/*
+ * Snapshot compression, a run-length coder working against the previous
+ * message exchanged on the same connection.
+ *
+ * Consecutive snapshots share most of their bytes: tanks hold still or move
+ * a few pixels per tick and positions are big-endian, so only the low byte of
+ * each coordinate changes. The encoder emits the spans matching the history
+ * as a single token and copies everything else verbatim.
+ *
+ * Token byte
+ * ----------
+ * 1xxxxxxx        copy (x + 1) bytes from the history at the current offset
+ * 0xxxxxxx        (x + 1) literal bytes follow
+ *
+ * Both peers must see the same messages in the same order, which TCP gives
+ * us for free.
+ */
+#include "compress.h"
+
+#include <string.h>
+
+#define MAX_RUN   128
+#define COPY_FLAG 0x80
+
+void compress_context_init(Compress_Context *ctx) { ctx->history_len = 0; }
+
+static inline int history_match(const Compress_Context *ctx,
+                                const unsigned char *src, size_t i)
+{
+    return i < ctx->history_len && src[i] == ctx->history[i];
+}
+
+size_t compress_encode(Compress_Context *ctx, const unsigned char *src,
+                       size_t len, unsigned char *dst)
+{
+    size_t i = 0, out = 0;
+
+    while (i < len) {
+        size_t run = 0;
+        while (i + run < len && run < MAX_RUN && history_match(ctx, src, i + run))
+            run++;
+
+        if (run > 0) {
+            dst[out++] = COPY_FLAG | (run - 1);
+            i += run;
+            continue;
+        }
+
+        // Literals run until at least two bytes in a row match the history,
+        // a single matching byte would cost a token byte anyway
+        size_t start = i;
+        while (i < len && i - start < MAX_RUN &&
+               !(history_match(ctx, src, i) &&
+                 (i + 1 == len || history_match(ctx, src, i + 1))))
+            i++;
+
+        dst[out++] = i - start - 1;
+        memcpy(dst + out, src + start, i - start);
+        out += i - start;
+    }
+
+    if (len <= COMPRESS_HISTORY_SIZE) {
+        memcpy(ctx->history, src, len);
+        ctx->history_len = len;
+    } else {
+        ctx->history_len = 0;
+    }
+
+    return out;
+}
+
+/*
+ * Decodes `len` bytes from `src` into `dst`, returns the decoded length or -1
+ * if the input is malformed, doesn't match the history or doesn't fit in
+ * `capacity` bytes.
+ */
+int compress_decode(Compress_Context *ctx, const unsigned char *src,
+                    size_t len, unsigned char *dst, size_t capacity)
+{
+    size_t i = 0, out = 0;
+
+    while (i < len) {
+        unsigned char token = src[i++];
+        size_t run          = (token & ~COPY_FLAG) + 1;
+
+        if (out + run > capacity) return -1;
+
+        if (token & COPY_FLAG) {
+            if (out + run > ctx->history_len) return -1;
+            memcpy(dst + out, ctx->history + out, run);
+        } else {
+            if (i + run > len) return -1;
+            memcpy(dst + out, src + i, run);
+            i += run;
+        }
+        out += run;
+    }
+
+    if (out <= COMPRESS_HISTORY_SIZE) {
+        memcpy(ctx->history, dst, out);
+        ctx->history_len = out;
+    } else {
+        ctx->history_len = 0;
+    }
+
+    return out;
+}
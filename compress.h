@@ -0,0 +1,25 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stdio.h>
+
+// Largest message that can be kept as history, way above any snapshot
+#define COMPRESS_HISTORY_SIZE 2048
+
+// Worst case size of `len` bytes once encoded, a token every 128 literals
+#define COMPRESS_BOUND(len)   ((len) + ((len) + 127) / 128)
+
+// Per connection compression state, both peers keep the last message
+// exchanged and encode the next one against it
+typedef struct {
+    unsigned char history[COMPRESS_HISTORY_SIZE];
+    size_t history_len;
+} Compress_Context;
+
+void compress_context_init(Compress_Context *ctx);
+size_t compress_encode(Compress_Context *ctx, const unsigned char *src,
+                       size_t len, unsigned char *dst);
+int compress_decode(Compress_Context *ctx, const unsigned char *src,
+                    size_t len, unsigned char *dst, size_t capacity);
+
+#endif
@@ -3,8 +3,18 @@
 
 #include <stdlib.h>
 
+#include "history.h"
+
 #define RANDOM(min, max) min + rand() / (RAND_MAX / (max - min + 1) + 1)
 
+// Generations are 24 bits wide and skip 0, which is reserved for the
+// empty slots
+static unsigned next_generation(unsigned generation)
+{
+    generation = (generation + 1) & 0xffffff;
+    return generation ? generation : 1;
+}
+
 static void init_bullet(const Tank *tank, Bullet *bullet)
 {
     bullet->active    = false;
@@ -15,23 +25,30 @@ static void init_bullet(const Tank *tank, Bullet *bullet)
 
 void game_state_init(Game_State *state)
 {
-    state->active_players = 0;
-    state->power_up.x     = 0;
-    state->power_up.y     = 0;
-    state->power_up.kind  = NONE;
+    state->active_players      = 0;
+    state->player_index        = 0;
+    state->tick                = 0;
+    state->power_up.x          = 0;
+    state->power_up.y          = 0;
+    state->power_up.kind       = NONE;
+    state->power_up.generation = 0;
+    state->history             = NULL;
     for (size_t i = 0; i < MAX_PLAYERS; ++i) {
-        state->players[i].x         = 0;
-        state->players[i].y         = 0;
-        state->players[i].hp        = 0;
-        state->players[i].direction = IDLE;
-        state->players[i].alive     = false;
-        for (size_t j = 0; j < MAX_AMMO; ++j)
+        state->players[i].x          = 0;
+        state->players[i].y          = 0;
+        state->players[i].hp         = 0;
+        state->players[i].direction  = IDLE;
+        state->players[i].alive      = false;
+        state->players[i].generation = 0;
+        state->players[i].input      = 0;
+        state->players[i].view_tick  = 0;
+        for (size_t j = 0; j < MAX_AMMO; ++j) {
             init_bullet(&state->players[i], &state->players[i].bullet[j]);
+            state->players[i].bullet[j].generation = 0;
+        }
     }
 }
 
-void game_state_free(Game_State *state) { free(state->players); }
-
 void game_state_spawn_tank(Game_State *state, size_t index)
 {
     if (!state->players[index].alive) {
@@ -40,6 +57,10 @@ void game_state_spawn_tank(Game_State *state, size_t index)
         state->players[index].x         = RANDOM(15, SCREEN_WIDTH);
         state->players[index].y         = RANDOM(15, SCREEN_HEIGHT);
         state->players[index].direction = IDLE;
+        state->players[index].input     = 0;
+        state->players[index].view_tick = 0;
+        state->players[index].generation =
+            next_generation(state->players[index].generation);
         state->active_players++;
     }
 }
@@ -48,24 +69,37 @@ void game_state_dismiss_tank(Game_State *state, size_t index)
 {
     state->players[index].alive = false;
     state->players[index].hp    = 0;
+    state->players[index].input     = 0;
+    state->players[index].view_tick = 0;
+    // Bullets in flight leave with their owner, or whoever takes the slot
+    // next would inherit them
+    for (size_t j = 0; j < MAX_AMMO; ++j)
+        state->players[index].bullet[j].active = false;
     state->active_players--;
 }
 
 void game_state_generate_power_up(Game_State *state)
 {
-    state->power_up.x    = RANDOM(1, SCREEN_WIDTH);
-    state->power_up.y    = RANDOM(1, SCREEN_HEIGHT);
-    state->power_up.kind = RANDOM(1, 3);
+    state->power_up.x          = RANDOM(1, SCREEN_WIDTH);
+    state->power_up.y          = RANDOM(1, SCREEN_HEIGHT);
+    state->power_up.kind       = RANDOM(1, 3);
+    state->power_up.generation = next_generation(state->power_up.generation);
 }
 
-static void fire_bullet(Tank *tank)
+static void rewind_bullet(Game_State *state, size_t owner, Bullet *bullet);
+
+static void fire_bullet(Game_State *state, size_t tank_index)
 {
+    Tank *tank = &state->players[tank_index];
     for (int i = 0; i < MAX_AMMO; ++i) {
         if (!tank->bullet[i].active) {
-            tank->bullet[i].active    = true;
-            tank->bullet[i].x         = tank->x;
-            tank->bullet[i].y         = tank->y;
-            tank->bullet[i].direction = tank->direction;
+            tank->bullet[i].active     = true;
+            tank->bullet[i].x          = tank->x;
+            tank->bullet[i].y          = tank->y;
+            tank->bullet[i].direction  = tank->direction;
+            tank->bullet[i].generation =
+                next_generation(tank->bullet[i].generation);
+            rewind_bullet(state, tank_index, &tank->bullet[i]);
             break;
         }
     }
@@ -92,13 +126,46 @@ void game_state_update_tank(Game_State *state, size_t tank_index,
             state->players[tank_index].direction = RIGHT;
             break;
         case FIRE:
-            fire_bullet(&state->players[tank_index]);
+            fire_bullet(state, tank_index);
             break;
         default:
             break;
     }
 }
 
+// Replaces the input held by the player, applied from the next update on,
+// a fire not yet consumed by an update survives the release of the key
+void game_state_set_input(Game_State *state, size_t tank_index,
+                          unsigned input)
+{
+    Tank *tank  = &state->players[tank_index];
+    tank->input = (input & INPUT_MASK) | (tank->input & INPUT_FIRE);
+}
+
+// A single direction per tick, when more are held the first one in the
+// order the keyboard used to be polled wins
+unsigned game_state_input_direction(unsigned input)
+{
+    if (input & INPUT_RIGHT) return RIGHT;
+    if (input & INPUT_LEFT) return LEFT;
+    if (input & INPUT_UP) return UP;
+    if (input & INPUT_DOWN) return DOWN;
+    return IDLE;
+}
+
+static void apply_input(Game_State *state, size_t tank_index)
+{
+    Tank *tank = &state->players[tank_index];
+    if (!tank->alive || tank->input == 0) return;
+
+    game_state_update_tank(state, tank_index,
+                           game_state_input_direction(tank->input));
+    if (tank->input & INPUT_FIRE) {
+        game_state_update_tank(state, tank_index, FIRE);
+        tank->input &= ~INPUT_FIRE;
+    }
+}
+
 static void update_bullet(Bullet *bullet)
 {
     if (!bullet->active) return;
@@ -159,20 +226,71 @@ static void check_power_up(Game_State *state, Tank *tank)
     }
 }
 
+static void hit_tank(Tank *tank, Bullet *bullet)
+{
+    tank->hp--;
+    if (tank->hp < 0) tank->hp = 0;
+    if (tank->hp == 0) tank->alive = false;
+    bullet->active = false;
+}
+
 static void check_collision(Tank *tank, Bullet *bullet)
 {
-    if (bullet->active && tank->x == bullet->x && tank->y == bullet->y) {
-        tank->hp--;
-        if (tank->hp < 0) tank->hp = 0;
-        if (tank->hp == 0) tank->alive = false;
-        bullet->active = false;
+    if (bullet->active && tank->x == bullet->x && tank->y == bullet->y)
+        hit_tank(tank, bullet);
+}
+
+/*
+ * Lag compensation, the first moves of a bullet just fired are checked
+ * against the tanks where the shooter saw them: a copy of the bullet goes
+ * through the ticks recorded after the one its owner was looking at, at most
+ * REWIND_MAX_TICKS, and is checked against the tanks as they were at each.
+ * A hit back there lands now, on the same tank if still alive. Otherwise the
+ * bullet itself is left where it was fired from, in the present, moving it
+ * ahead by the ticks rewound would make it jump by up to ~100 px on every
+ * screen. Without history this is a no-op.
+ */
+static void rewind_bullet(Game_State *state, size_t owner, Bullet *bullet)
+{
+    Tank_History *history = state->history;
+    uint32_t view_tick    = state->players[owner].view_tick;
+    if (!history || view_tick == 0 || history->empty) return;
+
+    Bullet probe     = *bullet;
+    uint32_t start   = tank_history_rewind_start(history, view_tick);
+    uint32_t rewound = 0;
+    for (uint32_t t = start + 1; probe.active && bullet->active; ++t) {
+        const History_Frame *frame = tank_history_frame(history, t);
+        if (!frame) break;
+        update_bullet(&probe);
+        rewound++;
+        for (size_t i = 0; i < MAX_PLAYERS && probe.active; ++i) {
+            Tank *tank = &state->players[i];
+            if (i == owner || !tank->alive ||
+                frame->generation[i] != tank->generation)
+                continue;
+            if (frame->x[i] == probe.x && frame->y[i] == probe.y) {
+                hit_tank(tank, bullet);
+                history->stats.hits++;
+                break;
+            }
+        }
     }
+
+    if (rewound == 0) return;
+    history->stats.rewinds++;
+    history->stats.rewound_ticks += rewound;
+    if (rewound > history->stats.max_rewound_ticks)
+        history->stats.max_rewound_ticks = rewound;
 }
 
 /**
- * Updates the game state by advancing bullets and checking for collisions
- * between tanks and bullets.
+ * Updates the game state by moving the tanks according to the input held
+ * by their players, advancing bullets and checking for collisions between
+ * tanks and bullets.
  *
+ * - Counts the tick, snapshots are timestamped with it.
+ * - Moves every alive tank by the input held with `apply_input`.
  * - Creates an array of pointers to each player's bullet for easy access during
  *   collision checks.
  * - For each player:
@@ -180,10 +298,14 @@ static void check_collision(Tank *tank, Bullet *bullet)
  *   - Checks for collisions between the player's tank and every other player's
  *     bullet using `check_collision`.
  * - Skips collision checks between a player and their own bullet.
+ * - Records the tanks in the history for lag compensation, if any.
  */
 void game_state_update(Game_State *state)
 {
     Bullet *bullets[MAX_PLAYERS][MAX_AMMO];
+    state->tick++;
+    for (size_t i = 0; i < MAX_PLAYERS; ++i) apply_input(state, i);
+
     for (size_t i = 0; i < MAX_PLAYERS; ++i) {
         check_power_up(state, &state->players[i]);
         for (size_t j = 0; j < MAX_AMMO; ++j) {
@@ -200,6 +322,8 @@ void game_state_update(Game_State *state)
             }
         }
     }
+
+    if (state->history) tank_history_record(state->history, state);
 }
 
 // TODO make this more efficient by counting the ammo directly in
@@ -213,6 +337,98 @@ int game_state_ammo(const Game_State *state, size_t index)
     return count;
 }
 
+/*
+ * ENTITY HANDLES
+ * ==============
+ * The table of handles is what clients key their per-entity caches on: the
+ * server diffs the tables of two consecutive ticks into spawn and despawn
+ * records, a client applies them to its own copy.
+ */
+void game_state_entities(const Game_State *state, Entity_Table *table)
+{
+    for (size_t i = 0; i < MAX_PLAYERS; ++i) {
+        const Tank *tank = &state->players[i];
+        table->tanks[i] = tank->alive ? ENTITY_HANDLE(i, tank->generation) : 0;
+        for (size_t j = 0; j < MAX_AMMO; ++j) {
+            const Bullet *bullet = &tank->bullet[j];
+            size_t slot          = i * MAX_AMMO + j;
+            table->bullets[slot] =
+                bullet->active ? ENTITY_HANDLE(slot, bullet->generation) : 0;
+        }
+    }
+    table->power_up[0] = state->power_up.kind != NONE
+                             ? ENTITY_HANDLE(0, state->power_up.generation)
+                             : 0;
+}
+
+size_t entity_table_slots(Entity_Kind kind)
+{
+    switch (kind) {
+        case ENTITY_TANK:
+            return MAX_PLAYERS;
+        case ENTITY_BULLET:
+            return MAX_PLAYERS * MAX_AMMO;
+        case ENTITY_POWER_UP:
+            return 1;
+        default:
+            break;
+    }
+
+    return 0;
+}
+
+static Entity_Handle *table_slots(Entity_Table *table, Entity_Kind kind)
+{
+    switch (kind) {
+        case ENTITY_TANK:
+            return table->tanks;
+        case ENTITY_BULLET:
+            return table->bullets;
+        default:
+            return table->power_up;
+    }
+}
+
+Entity_Handle entity_table_get(const Entity_Table *table, Entity_Kind kind,
+                               size_t slot)
+{
+    return table_slots((Entity_Table *)table, kind)[slot];
+}
+
+/*
+ * Writes the records turning `from` into `to` and returns their count, at
+ * most ENTITY_EVENTS_MAX. A slot that changed hands yields the despawn of
+ * the old entity followed by the spawn of the new one.
+ */
+size_t entity_table_diff(const Entity_Table *from, const Entity_Table *to,
+                         Entity_Event *events)
+{
+    size_t count = 0;
+    for (Entity_Kind kind = ENTITY_TANK; kind < ENTITY_KINDS; ++kind) {
+        for (size_t i = 0; i < entity_table_slots(kind); ++i) {
+            Entity_Handle old = entity_table_get(from, kind, i);
+            Entity_Handle new = entity_table_get(to, kind, i);
+            if (old == new) continue;
+            if (old)
+                events[count++] = (Entity_Event){ENTITY_DESPAWN, kind, old};
+            if (new)
+                events[count++] = (Entity_Event){ENTITY_SPAWN, kind, new};
+        }
+    }
+    return count;
+}
+
+// Events are expected to be validated already, see protocol.c
+void entity_table_apply(Entity_Table *table, const Entity_Event *event)
+{
+    Entity_Handle *slot =
+        &table_slots(table, event->kind)[ENTITY_SLOT(event->handle)];
+    if (event->event == ENTITY_SPAWN)
+        *slot = event->handle;
+    else if (*slot == event->handle)
+        *slot = 0;
+}
+
 const char *str_action(unsigned action)
 {
     switch (action) {
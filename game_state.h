@@ -2,6 +2,7 @@
 #define GAME_STATE_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 
 #define MAX_AMMO      5
@@ -11,6 +12,10 @@
 #define SCREEN_WIDTH  800
 #define SCREEN_HEIGHT 600
 
+// Interval between two updates of the game state on the server, ~60 FPS,
+// clients predicting their own tank run at the same pace
+#define TICK_US       16000
+
 // Possible directions a tank or bullet can move.
 typedef enum { IDLE, UP, DOWN, LEFT, RIGHT } Direction;
 
@@ -20,28 +25,72 @@ typedef enum {
     FIRE = 5,
 } Action;
 
+// Input state of a player, the directions held down and the fire key
+// pressed since the last input sent. The server keeps applying the held
+// directions every tick until the next input arrives, fire is one-shot.
+typedef enum {
+    INPUT_UP    = 1 << 0,
+    INPUT_DOWN  = 1 << 1,
+    INPUT_LEFT  = 1 << 2,
+    INPUT_RIGHT = 1 << 3,
+    INPUT_FIRE  = 1 << 4,
+} Input;
+
+#define INPUT_MASK \
+    (INPUT_UP | INPUT_DOWN | INPUT_LEFT | INPUT_RIGHT | INPUT_FIRE)
+
 // Power-ups are meant to be spawned randomly in the battlefield, whoever
 // steps on one gets the bonus, first arrived first served
 typedef enum { NONE, HP_PLUS_ONE, HP_PLUS_THREE, AMMO_PLUS_ONE } Power_Up;
 
+/*
+ * Schema of the entities, every field is declared once here as
+ * X(type, name, wire codec) and both the structs below and their wire
+ * encoding (protocol.h) are generated from it. Codecs:
+ *
+ * - I32      4 bytes big-endian
+ * - U8       a single byte
+ * - PRESENT  not written, true for every entity listed in a snapshot
+ *
+ * Adding a field here is all it takes to put it on the wire. Bookkeeping
+ * that never leaves the server, such as the slot generations, is declared
+ * in the structs after the schema.
+ */
+#define BULLET_FIELDS(X)        \
+    X(int, x, I32)              \
+    X(int, y, I32)              \
+    X(Direction, direction, U8) \
+    X(bool, active, PRESENT)
+
+#define TANK_FIELDS(X)          \
+    X(int, x, I32)              \
+    X(int, y, I32)              \
+    X(int, hp, I32)             \
+    X(Direction, direction, U8) \
+    X(bool, alive, PRESENT)
+
+#define DECLARE_FIELD(type, name, codec) type name;
+
+// Recent tank positions for lag compensation, server side only, history.h
+typedef struct tank_history Tank_History;
+
 // Represents a bullet with its position, direction, and status.
 // Can include bullet kinds as a possible update for the future.
 typedef struct {
-    int x;
-    int y;
-    Direction direction;
-    bool active;
+    BULLET_FIELDS(DECLARE_FIELD)
+    unsigned generation;
 } Bullet;
 
 // Represents a tank with its position, direction, and status.
 // Contains a single bullet for simplicity, can be extended in
 // the future to handle multiple bullets, life points, power-ups etc.
 typedef struct {
-    int x;
-    int y;
-    int hp;
-    Direction direction;
-    bool alive;
+    TANK_FIELDS(DECLARE_FIELD)
+    unsigned generation;
+    unsigned input;
+    // Tick of the game state the player was looking at when sending the
+    // last command, 0 if unknown, fires are rewound to it
+    uint32_t view_tick;
     Bullet bullet[MAX_AMMO];
 } Tank;
 
@@ -49,15 +98,59 @@ typedef struct {
     Tank players[MAX_PLAYERS];
     size_t active_players;
     size_t player_index;
+    uint32_t tick;
     struct {
         int x, y;
         Power_Up kind;
+        unsigned generation;
     } power_up;
+    // Recorded every update and used to rewind the fires when set
+    Tank_History *history;
 } Game_State;
 
+/*
+ * Generational handles, the slot of the entity in the game state in the low
+ * byte and the generation of the slot in the upper 24 bits. A slot gets a
+ * new generation every time a new entity takes it, so a handle kept past a
+ * despawn never matches whatever reuses the slot. Handle 0 is never a live
+ * entity.
+ */
+typedef uint32_t Entity_Handle;
+
+#define ENTITY_HANDLE(slot, generation) \
+    ((Entity_Handle)(generation) << 8 | (Entity_Handle)(slot))
+#define ENTITY_SLOT(handle)       ((handle) & 0xff)
+#define ENTITY_GENERATION(handle) ((handle) >> 8)
+
+typedef enum {
+    ENTITY_TANK,
+    ENTITY_BULLET,
+    ENTITY_POWER_UP,
+    ENTITY_KINDS
+} Entity_Kind;
+
+typedef enum { ENTITY_SPAWN = 1, ENTITY_DESPAWN } Entity_Event_Kind;
+
+typedef struct {
+    Entity_Event_Kind event;
+    Entity_Kind kind;
+    Entity_Handle handle;
+} Entity_Event;
+
+// Handle of the entity in every slot, 0 for the empty ones, bullets are
+// numbered `owner * MAX_AMMO + slot` as in the snapshots
+typedef struct {
+    Entity_Handle tanks[MAX_PLAYERS];
+    Entity_Handle bullets[MAX_PLAYERS * MAX_AMMO];
+    Entity_Handle power_up[1];
+} Entity_Table;
+
+// At most a despawn and a spawn per slot between two tables
+#define ENTITY_EVENTS_MAX \
+    (2 * (MAX_PLAYERS + MAX_PLAYERS * MAX_AMMO + 1))
+
 // General game state managing
 void game_state_init(Game_State *state);
-void game_state_free(Game_State *state);
 void game_state_update(Game_State *state);
 void game_state_generate_power_up(Game_State *state);
 
@@ -66,8 +159,20 @@ void game_state_spawn_tank(Game_State *state, size_t index);
 void game_state_dismiss_tank(Game_State *state, size_t index);
 void game_state_update_tank(Game_State *state, size_t tank_index,
                             unsigned action);
+void game_state_set_input(Game_State *state, size_t tank_index,
+                          unsigned input);
+unsigned game_state_input_direction(unsigned input);
 int game_state_ammo(const Game_State *state, size_t index);
 
+// Entity handles
+void game_state_entities(const Game_State *state, Entity_Table *table);
+size_t entity_table_slots(Entity_Kind kind);
+Entity_Handle entity_table_get(const Entity_Table *table, Entity_Kind kind,
+                               size_t slot);
+size_t entity_table_diff(const Entity_Table *from, const Entity_Table *to,
+                         Entity_Event *events);
+void entity_table_apply(Entity_Table *table, const Entity_Event *event);
+
 const char *str_action(unsigned action);
 
 #endif
@@ -0,0 +1,51 @@
+/*
+ * Server side history of the tank positions for lag compensation, a player
+ * fires at the tanks as drawn on their screen, interpolated some time in
+ * the past, the hits of that fire are checked against the frames recorded
+ * here instead of the current positions, see game_state.c.
+ */
+#include "history.h"
+
+#include <string.h>
+
+void tank_history_init(Tank_History *history)
+{
+    memset(history, 0x00, sizeof(*history));
+    history->empty = true;
+}
+
+void tank_history_record(Tank_History *history, const Game_State *state)
+{
+    History_Frame *frame = &history->frames[state->tick % HISTORY_TICKS];
+    frame->tick          = state->tick;
+    for (size_t i = 0; i < MAX_PLAYERS; ++i) {
+        const Tank *tank     = &state->players[i];
+        frame->x[i]          = tank->x;
+        frame->y[i]          = tank->y;
+        frame->generation[i] = tank->alive ? tank->generation : 0;
+    }
+    history->last  = state->tick;
+    history->empty = false;
+}
+
+// Frame recorded at `tick`, NULL if it's not in the ring (anymore or yet)
+const History_Frame *tank_history_frame(const Tank_History *history,
+                                        uint32_t tick)
+{
+    if (history->empty || tick > history->last ||
+        history->last - tick >= HISTORY_TICKS)
+        return NULL;
+    const History_Frame *frame = &history->frames[tick % HISTORY_TICKS];
+    return frame->tick == tick ? frame : NULL;
+}
+
+// Tick a rewind to `tick` actually starts from, clamped to REWIND_MAX_TICKS
+// behind the last frame; ticks not in the past yield the last one, that is
+// no rewind at all
+uint32_t tank_history_rewind_start(const Tank_History *history, uint32_t tick)
+{
+    if (tick >= history->last) return history->last;
+    if (history->last - tick > REWIND_MAX_TICKS)
+        return history->last - REWIND_MAX_TICKS;
+    return tick;
+}
@@ -0,0 +1,53 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "game_state.h"
+
+// Ticks of tank positions kept, a power of two, ~256 ms at TICK_US
+#define HISTORY_TICKS    16
+// Furthest back a fire is rewound, ~200 ms, players lagging more than that
+// have to lead their targets by the difference
+#define REWIND_MAX_TICKS 12
+
+// Where the tanks were at the end of a tick, generation 0 for the slots
+// without a live tank. Positions are as wide as in the game state, nothing
+// keeps a tank on the screen and a narrower type would wrap once it drives
+// far enough off it, matching a bullet that's nowhere near.
+typedef struct {
+    uint32_t tick;
+    int32_t x[MAX_PLAYERS];
+    int32_t y[MAX_PLAYERS];
+    uint32_t generation[MAX_PLAYERS];
+} History_Frame;
+
+// What lag compensation costs, the frames are a fixed HISTORY_TICKS
+typedef struct {
+    uint64_t rewinds;
+    uint64_t rewound_ticks;
+    uint32_t max_rewound_ticks;
+    uint64_t hits;
+} History_Stats;
+
+/*
+ * Ring of the last HISTORY_TICKS frames, indexed by tick. Recording is a
+ * copy of MAX_PLAYERS positions per tick, a rewind walks at most
+ * REWIND_MAX_TICKS frames checking MAX_PLAYERS tanks in each.
+ */
+struct tank_history {
+    History_Frame frames[HISTORY_TICKS];
+    uint32_t last;
+    bool empty;
+    History_Stats stats;
+};
+
+void tank_history_init(Tank_History *history);
+void tank_history_record(Tank_History *history, const Game_State *state);
+const History_Frame *tank_history_frame(const Tank_History *history,
+                                        uint32_t tick);
+uint32_t tank_history_rewind_start(const Tank_History *history,
+                                   uint32_t tick);
+
+#endif
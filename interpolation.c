@@ -0,0 +1,164 @@
+/*
+ * Snapshot interpolation, entities other than the player tank are drawn a
+ * fixed INTERPOLATION_DELAY behind the server clock, between the two
+ * snapshots surrounding that instant, so that network jitter and snapshot
+ * rates well below the frame rate still give smooth motion.
+ *
+ * Snapshots are timestamped with the server tick, the server clock is
+ * estimated from their arrival times, smoothed to absorb the jitter. An
+ * entity is only blended between two snapshots if it's the same one in both,
+ * according to the entity handles; without CAP_ENTITIES the tables are empty
+ * and the slot alone decides.
+ */
+#include "interpolation.h"
+
+#define TICK_SECONDS        (TICK_US / 1e6)
+// Weight of a new arrival in the clock offset estimate
+#define OFFSET_SMOOTHING    0.05
+// Arrivals this far off the estimate mean the clocks jumped (a stall, a
+// reconnection), the estimate restarts from them
+#define OFFSET_RESYNC_LIMIT 0.5
+
+void interpolation_init(Interpolation *interpolation)
+{
+    interpolation->head   = 0;
+    interpolation->count  = 0;
+    interpolation->offset = 0.0;
+}
+
+static const Interpolation_Snapshot *snapshot_at(
+    const Interpolation *interpolation, size_t i)
+{
+    return &interpolation->snapshots[(interpolation->head + i) %
+                                     INTERPOLATION_SNAPSHOTS];
+}
+
+static double snapshot_time(const Interpolation_Snapshot *snapshot)
+{
+    return snapshot->tick * TICK_SECONDS;
+}
+
+// Snapshots not newer than the last one are dropped, unless they are so far
+// behind that the server must have restarted, then the buffer starts over
+void interpolation_push(Interpolation *interpolation, uint32_t tick,
+                        const Game_State *state, const Entity_Table *entities,
+                        double now)
+{
+    if (interpolation->count > 0 &&
+        tick <= snapshot_at(interpolation, interpolation->count - 1)->tick) {
+        if (tick + INTERPOLATION_SNAPSHOTS >
+            snapshot_at(interpolation, interpolation->count - 1)->tick)
+            return;
+        interpolation->count = 0;
+    }
+
+    double sample = now - tick * TICK_SECONDS;
+    if (interpolation->count == 0 ||
+        sample - interpolation->offset > OFFSET_RESYNC_LIMIT ||
+        interpolation->offset - sample > OFFSET_RESYNC_LIMIT)
+        interpolation->offset = sample;
+    else
+        interpolation->offset += (sample - interpolation->offset) *
+                                 OFFSET_SMOOTHING;
+
+    if (interpolation->count == INTERPOLATION_SNAPSHOTS) {
+        interpolation->head = (interpolation->head + 1) %
+                              INTERPOLATION_SNAPSHOTS;
+        interpolation->count--;
+    }
+
+    Interpolation_Snapshot *snapshot =
+        &interpolation->snapshots[(interpolation->head + interpolation->count) %
+                                  INTERPOLATION_SNAPSHOTS];
+    snapshot->tick     = tick;
+    snapshot->state    = *state;
+    snapshot->entities = *entities;
+    interpolation->count++;
+}
+
+static float lerp(int a, int b, double alpha)
+{
+    return a + (b - a) * alpha;
+}
+
+/*
+ * Positions at `alpha` between `from` (0) and `to` (1), above 1 they are
+ * extrapolated along the same line. Entities only in one of the two are
+ * taken as they are in the nearest one.
+ */
+static void blend(const Interpolation_Snapshot *from,
+                  const Interpolation_Snapshot *to, double alpha,
+                  Interpolated_State *out)
+{
+    const Interpolation_Snapshot *nearest = alpha < 0.5 ? from : to;
+    out->state                            = nearest->state;
+    out->state.tick                       = nearest->tick;
+
+    for (size_t i = 0; i < MAX_PLAYERS; ++i) {
+        const Tank *a = &from->state.players[i], *b = &to->state.players[i];
+        const Tank *n = &nearest->state.players[i];
+        out->tank_x[i] = n->x;
+        out->tank_y[i] = n->y;
+        if (a->alive && b->alive &&
+            from->entities.tanks[i] == to->entities.tanks[i]) {
+            out->tank_x[i] = lerp(a->x, b->x, alpha);
+            out->tank_y[i] = lerp(a->y, b->y, alpha);
+        }
+
+        for (size_t j = 0; j < MAX_AMMO; ++j) {
+            size_t slot       = i * MAX_AMMO + j;
+            const Bullet *ba = &a->bullet[j], *bb = &b->bullet[j];
+            const Bullet *bn = &n->bullet[j];
+            out->bullet_x[slot] = bn->x;
+            out->bullet_y[slot] = bn->y;
+            if (ba->active && bb->active &&
+                from->entities.bullets[slot] == to->entities.bullets[slot]) {
+                out->bullet_x[slot] = lerp(ba->x, bb->x, alpha);
+                out->bullet_y[slot] = lerp(ba->y, bb->y, alpha);
+            }
+        }
+    }
+}
+
+/*
+ * Fills `out` with the entities as of INTERPOLATION_DELAY ago on the server
+ * clock, returns false if there's no snapshot yet.
+ */
+bool interpolation_sample(const Interpolation *interpolation, double now,
+                          Interpolated_State *out)
+{
+    if (interpolation->count == 0) return false;
+
+    double t = now - interpolation->offset - INTERPOLATION_DELAY;
+    const Interpolation_Snapshot *oldest = snapshot_at(interpolation, 0);
+    const Interpolation_Snapshot *newest =
+        snapshot_at(interpolation, interpolation->count - 1);
+
+    if (interpolation->count == 1 || t <= snapshot_time(oldest)) {
+        const Interpolation_Snapshot *only =
+            t <= snapshot_time(oldest) ? oldest : newest;
+        blend(only, only, 0.0, out);
+        return true;
+    }
+
+    if (t >= snapshot_time(newest)) {
+        // Late snapshot, keep going the way the last two were heading
+        const Interpolation_Snapshot *previous =
+            snapshot_at(interpolation, interpolation->count - 2);
+        double ahead = t - snapshot_time(newest);
+        if (ahead > EXTRAPOLATION_LIMIT) ahead = EXTRAPOLATION_LIMIT;
+        double span = snapshot_time(newest) - snapshot_time(previous);
+        blend(previous, newest, 1.0 + ahead / span, out);
+        return true;
+    }
+
+    size_t i = interpolation->count - 2;
+    while (i > 0 && snapshot_time(snapshot_at(interpolation, i)) > t) --i;
+
+    const Interpolation_Snapshot *from = snapshot_at(interpolation, i);
+    const Interpolation_Snapshot *to   = snapshot_at(interpolation, i + 1);
+    blend(from, to, (t - snapshot_time(from)) /
+                        (snapshot_time(to) - snapshot_time(from)),
+          out);
+    return true;
+}
@@ -0,0 +1,51 @@
+#ifndef INTERPOLATION_H
+#define INTERPOLATION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "game_state.h"
+
+// Snapshots kept, half a second at the server tick rate
+#define INTERPOLATION_SNAPSHOTS 32
+// How far behind the server clock entities are drawn, seconds, enough to
+// still have a snapshot on both sides with a few of them late or lost
+#define INTERPOLATION_DELAY     0.1
+// How long entities keep moving past the newest snapshot when the next one
+// is late, seconds, they hold still after that
+#define EXTRAPOLATION_LIMIT     0.05
+
+typedef struct {
+    uint32_t tick;
+    Game_State state;
+    Entity_Table entities;
+} Interpolation_Snapshot;
+
+// Snapshots received, oldest first, and the estimated difference between
+// the local clock and the server one
+typedef struct {
+    Interpolation_Snapshot snapshots[INTERPOLATION_SNAPSHOTS];
+    size_t head;
+    size_t count;
+    double offset;
+} Interpolation;
+
+// What to draw at a given time, the positions of the entities as floats as
+// they fall between two snapshots, everything else (the tick included) as of
+// the nearest one
+typedef struct {
+    Game_State state;
+    float tank_x[MAX_PLAYERS];
+    float tank_y[MAX_PLAYERS];
+    float bullet_x[MAX_PLAYERS * MAX_AMMO];
+    float bullet_y[MAX_PLAYERS * MAX_AMMO];
+} Interpolated_State;
+
+void interpolation_init(Interpolation *interpolation);
+void interpolation_push(Interpolation *interpolation, uint32_t tick,
+                        const Game_State *state, const Entity_Table *entities,
+                        double now);
+bool interpolation_sample(const Interpolation *interpolation, double now,
+                          Interpolated_State *out);
+
+#endif
@@ -0,0 +1,181 @@
+#include "metrics.h"
+
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// From well under a tick to several of them, a tick is ~16ms
+const double metrics_tick_bounds[METRICS_TICK_BUCKETS] = {
+    0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.016, 0.025, 0.05};
+
+static const char *entity_kinds[ENTITY_KINDS] = {"tank", "bullet", "power_up"};
+
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t len;
+} Text;
+
+// Appends to the text, what doesn't fit is cut
+static void text_printf(Text *text, const char *fmt, ...)
+{
+    va_list args;
+    if (text->len >= text->size) return;
+
+    va_start(args, fmt);
+    int n = vsnprintf(text->buf + text->len, text->size - text->len, fmt, args);
+    va_end(args);
+    if (n > 0) text->len += n;
+    if (text->len > text->size - 1) text->len = text->size - 1;
+}
+
+static void text_counter(Text *text, const char *name, const char *help,
+                         uint64_t value)
+{
+    text_printf(text, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", name, help,
+                name, name, (unsigned long long)value);
+}
+
+/*
+ * Writes the metrics in the Prometheus text format, counters first, then
+ * the tick duration histogram and the gauges. Returns the length written.
+ */
+size_t metrics_format(const Metrics *metrics, const Metrics_Gauges *gauges,
+                      char *buf, size_t size)
+{
+    Text text = {buf, size, 0};
+
+    text_counter(&text, "battletank_ticks_total",
+                 "Game state updates broadcast.", metrics->ticks);
+    text_counter(&text, "battletank_tick_overruns_total",
+                 "Ticks started a whole tick late or more.",
+                 metrics->overruns);
+    text_counter(&text, "battletank_connections_total",
+                 "Connections seated as players.", metrics->connections);
+    text_counter(&text, "battletank_connections_rejected_total",
+                 "Connections refused, every seat taken.", metrics->rejected);
+    text_counter(&text, "battletank_actions_total",
+                 "Actions and inputs applied.", metrics->actions);
+    text_counter(&text, "battletank_received_bytes_total",
+                 "Bytes read from the players.", metrics->bytes_in);
+    text_counter(&text, "battletank_sent_bytes_total",
+                 "Bytes written to the players.", metrics->bytes_out);
+    text_counter(&text, "battletank_send_eagain_total",
+                 "Writes cut short by a full socket buffer.",
+                 metrics->send_eagain);
+
+    text_printf(&text,
+                "# HELP battletank_dropped_clients_total Players gone.\n"
+                "# TYPE battletank_dropped_clients_total counter\n"
+                "battletank_dropped_clients_total{reason=\"disconnected\"} "
+                "%llu\n"
+                "battletank_dropped_clients_total{reason=\"malformed\"} "
+                "%llu\n"
+                "battletank_dropped_clients_total{reason=\"stalled\"} "
+                "%llu\n"
+                "battletank_dropped_clients_total{reason=\"io_error\"} "
+                "%llu\n",
+                (unsigned long long)metrics->disconnected,
+                (unsigned long long)metrics->dropped,
+                (unsigned long long)metrics->stalled,
+                (unsigned long long)metrics->io_errors);
+
+    text_printf(&text,
+                "# HELP battletank_tick_duration_seconds Time to update and "
+                "broadcast the game state.\n"
+                "# TYPE battletank_tick_duration_seconds histogram\n");
+    for (size_t i = 0; i < METRICS_TICK_BUCKETS; ++i)
+        text_printf(&text,
+                    "battletank_tick_duration_seconds_bucket{le=\"%g\"} %llu\n",
+                    metrics_tick_bounds[i],
+                    (unsigned long long)metrics->tick_buckets[i]);
+    text_printf(&text,
+                "battletank_tick_duration_seconds_bucket{le=\"+Inf\"} %llu\n"
+                "battletank_tick_duration_seconds_sum %.9f\n"
+                "battletank_tick_duration_seconds_count %llu\n",
+                (unsigned long long)metrics->ticks, metrics->tick_seconds,
+                (unsigned long long)metrics->ticks);
+
+    text_printf(&text,
+                "# HELP battletank_players Players connected.\n"
+                "# TYPE battletank_players gauge\n"
+                "battletank_players %zu\n",
+                gauges->players);
+    text_printf(&text, "# HELP battletank_entities Entities in the match.\n"
+                       "# TYPE battletank_entities gauge\n");
+    for (Entity_Kind kind = ENTITY_TANK; kind < ENTITY_KINDS; ++kind)
+        text_printf(&text, "battletank_entities{kind=\"%s\"} %zu\n",
+                    entity_kinds[kind], gauges->entities[kind]);
+
+    return text.len;
+}
+
+// Listens on a Unix socket at `path`, a stale one left there is replaced
+int metrics_listen(const char *path)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) return -1;
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) goto err;
+    if (listen(fd, 8) < 0) goto err;
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) goto err;
+
+    return fd;
+
+err:
+    close(fd);
+    return -1;
+}
+
+// Takes a scrape waiting on the socket, it's answered once its request is in
+int metrics_accept(int listen_fd)
+{
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) return -1;
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * Answers a scrape whose request came in, or that closed its end, as an
+ * HTTP/1.0 response so that `curl --unix-socket` works, whatever the request
+ * was. Writes never wait, a scraper too slow to take a few KB at once gets
+ * them cut, the tick isn't held for it. Closes the scrape.
+ */
+int metrics_respond(int fd, const Metrics *metrics,
+                    const Metrics_Gauges *gauges)
+{
+    char body[METRICS_BUFSIZE], head[128];
+
+    // Drained, closing on unread data would reset the connection
+    while (recv(fd, body, sizeof(body), MSG_DONTWAIT) > 0)
+        ;
+
+    size_t len = metrics_format(metrics, gauges, body, sizeof(body));
+    int n      = snprintf(head, sizeof(head),
+                          "HTTP/1.0 200 OK\r\n"
+                          "Content-Type: text/plain; version=0.0.4\r\n"
+                          "Content-Length: %zu\r\n\r\n",
+                          len);
+
+    int err = 0;
+    if (send(fd, head, n, MSG_DONTWAIT | MSG_NOSIGNAL) != n ||
+        send(fd, body, len, MSG_DONTWAIT | MSG_NOSIGNAL) != (ssize_t)len)
+        err = -1;
+    close(fd);
+    return err;
+}
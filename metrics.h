@@ -0,0 +1,63 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "game_state.h"
+
+// Tick duration buckets, upper bounds in seconds, +Inf comes on top
+#define METRICS_TICK_BUCKETS 10
+// Room for a whole scrape, headers included
+#define METRICS_BUFSIZE      8192
+
+/*
+ * Counters owned by the thread updating them, plain increments with no
+ * atomics, cheap enough to be always on. The server loop is the only writer
+ * and serves the scrapes itself, so they are never read mid update.
+ * `tick_buckets` are cumulative, as Prometheus expects them: bucket i counts
+ * the ticks not longer than metrics_tick_bounds[i].
+ */
+typedef struct {
+    uint64_t ticks;
+    uint64_t tick_buckets[METRICS_TICK_BUCKETS];
+    double tick_seconds;
+    uint64_t overruns;
+    uint64_t connections;
+    uint64_t rejected;
+    uint64_t actions;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t send_eagain;
+    uint64_t disconnected;
+    uint64_t dropped;
+    uint64_t stalled;
+    uint64_t io_errors;
+} Metrics;
+
+// Read off the state at scrape time rather than counted
+typedef struct {
+    size_t players;
+    size_t entities[ENTITY_KINDS];
+} Metrics_Gauges;
+
+extern const double metrics_tick_bounds[METRICS_TICK_BUCKETS];
+
+static inline void metrics_observe_tick(Metrics *metrics, double seconds)
+{
+    metrics->ticks++;
+    metrics->tick_seconds += seconds;
+    for (size_t i = METRICS_TICK_BUCKETS; i > 0; --i) {
+        if (seconds > metrics_tick_bounds[i - 1]) break;
+        metrics->tick_buckets[i - 1]++;
+    }
+}
+
+size_t metrics_format(const Metrics *metrics, const Metrics_Gauges *gauges,
+                      char *buf, size_t size);
+int metrics_listen(const char *path);
+int metrics_accept(int listen_fd);
+int metrics_respond(int fd, const Metrics *metrics,
+                    const Metrics_Gauges *gauges);
+
+#endif
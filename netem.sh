@@ -0,0 +1,73 @@
+#!/bin/sh
+#
+# Runs the load generator through the impairment proxy, once per network
+# scenario, all on loopback, and prints a JSON object of the loadgen reports
+# keyed by scenario, to compare input latency and snapshot staleness as the
+# network degrades. Exits non zero as soon as a run fails.
+#
+# With -c every report is checked as well: all the bots must have played the
+# whole run, with no connection failed or dropped, and snapshots must have
+# kept coming. Failures are reported on stderr as they come, every scenario
+# still runs and the script exits non zero at the end.
+#
+# Usage: ./netem.sh [-c] [seconds per scenario, 10 by default] [scenarios...]
+
+set -e
+
+CHECK=
+if [ "$1" = "-c" ]; then
+    CHECK=1
+    shift
+fi
+DURATION=${1:-10}
+[ $# -gt 0 ] && shift
+SCENARIOS=${*:-lan wifi mobile lossy}
+PROXY_PORT=6700
+BOTS=5
+FAILED=0
+
+# Scenario name and loadgen report, fails unless every bot played it through
+check() {
+    printf '%s\n' "$2" | awk -v scenario="$1" -v bots=$BOTS '
+        /"connections"|"throughput"/ {
+            gsub(/[{},:"]/, " ")
+            for (i = 1; i < NF; ++i) value[$i] = $(i + 1)
+        }
+        END {
+            ok = value["playing"] == bots && value["failed"] == 0 &&
+                 value["dropped"] == 0 && value["snapshots_per_s"] > 0
+            if (!ok)
+                printf "[ERROR] %s: %d/%d playing, %d failed, %d dropped, " \
+                       "%s snapshots/s\n", scenario, value["playing"], bots,
+                       value["failed"], value["dropped"],
+                       value["snapshots_per_s"] | "cat 1>&2"
+            exit !ok
+        }'
+}
+
+./battletank-server > /dev/null 2>&1 &
+SERVER=$!
+PROXY=
+trap 'kill $SERVER $PROXY 2> /dev/null' EXIT
+sleep 0.5
+
+SEP=
+printf '{\n'
+for scenario in $SCENARIOS; do
+    ./battletank-proxy -l $PROXY_PORT -s "$scenario" 2> /dev/null &
+    PROXY=$!
+    sleep 0.2
+    printf '%s"%s":\n' "$SEP" "$scenario"
+    REPORT=$(./battletank-loadgen -p $PROXY_PORT -n $BOTS -r $BOTS \
+        -d "$DURATION" -m random 2> /dev/null)
+    printf '%s\n' "$REPORT"
+    if [ -n "$CHECK" ] && ! check "$scenario" "$REPORT"; then
+        FAILED=1
+    fi
+    kill $PROXY
+    wait $PROXY 2> /dev/null || true
+    PROXY=
+    SEP=','
+done
+printf '}\n'
+exit $FAILED
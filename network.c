@@ -1,6 +1,7 @@
 #include "network.h"
 
 #include <errno.h>
+#include <string.h>
 
 #include "protocol.h"
 
@@ -11,7 +12,7 @@ ssize_t network_send(int fd, const unsigned char *buf, size_t count)
 
     /* Let's reply to the client */
     while (written < count) {
-        n = write(fd, buf + written, count);
+        n = write(fd, buf + written, count - written);
         if (n == -1) {
             if (errno == EAGAIN || errno == EWOULDBLOCK)
                 break;
@@ -24,44 +25,43 @@ ssize_t network_send(int fd, const unsigned char *buf, size_t count)
     return written;
 }
 
-/**
- * Receives a serialized packet from the network over a socket file descriptor.
- *
- * - Reads the first 4 bytes to determine the total length of the packet.
- * - Reads data in a loop until the entire packet is received or an error
- *   occurs.
- * - If a non-blocking socket is used, it will return immediately when no data
- *   is available (errno = EAGAIN or EWOULDBLOCK).
+/*
+ * Reads as much as fits in the reader in a single read(2), what's left of
+ * the frames already handed out is dropped first. Returns the bytes read, 0
+ * if the peer closed the connection, -1 on errors, errno EAGAIN or
+ * EWOULDBLOCK included.
  */
-ssize_t network_recv(int fd, unsigned char *buf)
+ssize_t network_reader_fill(int fd, Frame_Reader *reader)
 {
-    int received = 0, count = sizeof(int);
+    size_t pending = reader->end - reader->start;
+    memmove(reader->buf, reader->buf + reader->start, pending);
+    reader->start = 0;
+    reader->end   = pending;
 
-    // Read the header length
-    ssize_t n = read(fd, buf, count);
-    if (n == -1) {
-        if (errno == EAGAIN || errno == EWOULDBLOCK)
-            goto exit;
-        else
-            return n;
-    }
-
-    int total_length = bin_read_i32(buf);
-    received += count;
+    ssize_t n     = read(fd, reader->buf + pending, sizeof(reader->buf) - pending);
+    if (n > 0) reader->end += n;
+    return n;
+}
 
-    // Read from the client the remaining packet
-    while (received < total_length) {
-        n = read(fd, buf + received, total_length - received);
-        if (n == -1) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK)
-                break;
-            else
-                return n;
-        }
+/*
+ * Next complete frame buffered, `frame` points to it, valid until the next
+ * fill. Returns its length, 0 if there's none yet, -1 with errno EMSGSIZE on
+ * a length that can't be a frame, the stream can't be trusted after that.
+ */
+ssize_t network_reader_next(Frame_Reader *reader, const unsigned char **frame)
+{
+    size_t pending = reader->end - reader->start;
+    if (pending < sizeof(int)) return 0;
 
-        received += n;
+    long int total_length = bin_read_i32(reader->buf + reader->start);
+    if (total_length < (long int)sizeof(int) ||
+        total_length > NETWORK_FRAME_SIZE) {
+        errno = EMSGSIZE;
+        return -1;
     }
+    if (pending < (size_t)total_length) return 0;
 
-exit:
-    return received;
+    *frame         = reader->buf + reader->start;
+    reader->start += total_length;
+    return total_length;
 }
@@ -3,7 +3,22 @@
 
 #include <unistd.h>
 
+// Largest frame a Frame_Reader takes, same as the peers' buffers
+#define NETWORK_FRAME_SIZE 2048
+
+/*
+ * Bytes read off a non-blocking socket and not consumed yet, frames are
+ * handed out from `start` as soon as they're complete, the rest waits for
+ * the next read. Holds up to two frames, a read can end midway the second.
+ */
+typedef struct {
+    unsigned char buf[NETWORK_FRAME_SIZE * 2];
+    size_t start;
+    size_t end;
+} Frame_Reader;
+
 ssize_t network_send(int fd, const unsigned char *buf, size_t count);
-ssize_t network_recv(int fd, unsigned char *buf);
+ssize_t network_reader_fill(int fd, Frame_Reader *reader);
+ssize_t network_reader_next(Frame_Reader *reader, const unsigned char **frame);
 
 #endif
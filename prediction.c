@@ -0,0 +1,93 @@
+/*
+ * Client side prediction of the player tank.
+ *
+ * Every command the player sends is applied locally right away through
+ * game_state_update_tank(), the same logic the server runs, and kept as a
+ * step until a snapshot acknowledges it. On each snapshot the tank is
+ * rewound to the authoritative state and the steps the server hasn't applied
+ * yet are replayed on top, so the player sees the effect of an input on the
+ * next frame while the server keeps the last word.
+ *
+ * Held input is applied by the server once per tick: the client records a
+ * step per local tick too, snapshots tell for how many ticks the last
+ * acknowledged command has run (`ack_ticks`), as many of its steps are
+ * dropped.
+ */
+#include "prediction.h"
+
+void prediction_init(Prediction *prediction, size_t index)
+{
+    game_state_init(&prediction->state);
+    prediction->index = index;
+    prediction->valid = false;
+    prediction->head  = 0;
+    prediction->count = 0;
+}
+
+static Tank *predicted(Prediction *prediction)
+{
+    return &prediction->state.players[prediction->index];
+}
+
+// Records a step and applies it to the predicted tank
+void prediction_push(Prediction *prediction, uint32_t sequence,
+                     unsigned action)
+{
+    if (prediction->count == PREDICTION_STEPS) {
+        prediction->head = (prediction->head + 1) % PREDICTION_STEPS;
+        prediction->count--;
+    }
+
+    size_t tail = (prediction->head + prediction->count) % PREDICTION_STEPS;
+    prediction->steps[tail] = (Prediction_Step){sequence, action};
+    prediction->count++;
+
+    if (prediction->valid)
+        game_state_update_tank(&prediction->state, prediction->index, action);
+}
+
+/*
+ * Drops the steps the server state already includes, every one older than
+ * `ack` and the first `ack_ticks` of `ack` itself, then replays the rest on
+ * top of the tank as received.
+ */
+void prediction_reconcile(Prediction *prediction, const Tank *server,
+                          uint32_t ack, uint32_t ack_ticks)
+{
+    while (prediction->count > 0) {
+        const Prediction_Step *step = &prediction->steps[prediction->head];
+        if (step->sequence > ack) break;
+        if (step->sequence == ack) {
+            if (ack_ticks == 0) break;
+            ack_ticks--;
+        }
+        prediction->head = (prediction->head + 1) % PREDICTION_STEPS;
+        prediction->count--;
+    }
+
+    Tank *tank = predicted(prediction);
+#define COPY_FIELD(type, name, codec) tank->name = server->name;
+    TANK_FIELDS(COPY_FIELD)
+#undef COPY_FIELD
+    prediction->valid = true;
+
+    for (size_t i = 0; i < prediction->count; ++i) {
+        const Prediction_Step *step =
+            &prediction->steps[(prediction->head + i) % PREDICTION_STEPS];
+        game_state_update_tank(&prediction->state, prediction->index,
+                               step->action);
+    }
+}
+
+// The tank is not in the last snapshot, nothing to predict until it is
+void prediction_invalidate(Prediction *prediction)
+{
+    prediction->valid = false;
+}
+
+// NULL while there's no server state to predict from
+const Tank *prediction_tank(const Prediction *prediction)
+{
+    if (!prediction->valid) return NULL;
+    return &prediction->state.players[prediction->index];
+}
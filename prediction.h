@@ -0,0 +1,39 @@
+#ifndef PREDICTION_H
+#define PREDICTION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "game_state.h"
+
+// Steps not yet acknowledged by the server that can be replayed, ~4s of
+// held input at the server tick rate, the oldest get dropped beyond that
+#define PREDICTION_STEPS 256
+
+// A single application of a command to the tank, either an action sent on
+// its own or one tick of held input
+typedef struct {
+    uint32_t sequence;
+    unsigned action;
+} Prediction_Step;
+
+// Client side copy of the player tank running ahead of the server, moved by
+// the same game logic the server applies to the commands it receives
+typedef struct {
+    Game_State state;
+    size_t index;
+    bool valid;
+    Prediction_Step steps[PREDICTION_STEPS];
+    size_t head;
+    size_t count;
+} Prediction;
+
+void prediction_init(Prediction *prediction, size_t index);
+void prediction_push(Prediction *prediction, uint32_t sequence,
+                     unsigned action);
+void prediction_reconcile(Prediction *prediction, const Tank *server,
+                          uint32_t ack, uint32_t ack_ticks);
+void prediction_invalidate(Prediction *prediction);
+const Tank *prediction_tank(const Prediction *prediction);
+
+#endif
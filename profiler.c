@@ -0,0 +1,181 @@
+#include "profiler.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+
+volatile bool profiler_enabled = false;
+
+static const char *phase_names[PHASES_COUNT] = {
+    "tick", "accept", "read", "apply", "update", "serialize", "broadcast"};
+
+static Profiler_Ring *_Atomic rings[PROFILER_THREADS];
+static atomic_size_t rings_count;
+
+static _Thread_local Profiler_Ring *ring;
+static _Thread_local bool ring_unavailable;
+
+const char *profiler_phase_name(Profiler_Phase phase)
+{
+    return phase < PHASES_COUNT ? phase_names[phase] : "unknown";
+}
+
+// Gives the calling thread a ring, NULL once PROFILER_THREADS are taken
+static Profiler_Ring *ring_register(void)
+{
+    size_t slot = atomic_fetch_add(&rings_count, 1);
+    if (slot >= PROFILER_THREADS) return NULL;
+
+    Profiler_Ring *new_ring = calloc(1, sizeof(*new_ring));
+    if (!new_ring) return NULL;
+    new_ring->tid = slot + 1;
+    atomic_store(&rings[slot], new_ring);
+    return new_ring;
+}
+
+// Bucket b holds the durations in [2^(b-1), 2^b) ns, 0 the empty ones
+static unsigned bucket_of(uint32_t duration_ns)
+{
+    unsigned bucket = duration_ns ? 32 - __builtin_clz(duration_ns) : 0;
+    return bucket < PROFILER_BUCKETS ? bucket : PROFILER_BUCKETS - 1;
+}
+
+void profiler_record(Profiler_Phase phase, int arg, uint64_t start_ns)
+{
+    if (!ring && !ring_unavailable) {
+        ring             = ring_register();
+        ring_unavailable = !ring;
+    }
+    if (!ring) return;
+
+    uint64_t elapsed     = profiler_now_ns() - start_ns;
+    uint32_t duration_ns = elapsed > UINT32_MAX ? UINT32_MAX : elapsed;
+
+    Profiler_Span *span = &ring->spans[ring->count++ % PROFILER_RING_SIZE];
+    span->start_ns      = start_ns;
+    span->duration_ns   = duration_ns;
+    span->phase         = phase;
+    span->arg           = arg;
+
+    ring->histograms[phase][bucket_of(duration_ns)]++;
+    ring->totals_ns[phase] += duration_ns;
+    if (duration_ns > ring->max_ns[phase]) ring->max_ns[phase] = duration_ns;
+}
+
+static size_t rings_taken(void)
+{
+    size_t count = atomic_load(&rings_count);
+    return count < PROFILER_THREADS ? count : PROFILER_THREADS;
+}
+
+bool profiler_has_spans(void)
+{
+    for (size_t i = 0; i < rings_taken(); ++i) {
+        const Profiler_Ring *r = atomic_load(&rings[i]);
+        if (r && r->count > 0) return true;
+    }
+    return false;
+}
+
+/*
+ * Writes the spans still in the rings as Chrome trace events, complete
+ * ones, timed from the earliest span, one trace thread per ring. Loads in
+ * chrome://tracing or ui.perfetto.dev.
+ */
+int profiler_write_trace(const char *path)
+{
+    FILE *fp = fopen(path, "w");
+    if (!fp) return -1;
+
+    uint64_t origin = UINT64_MAX;
+    for (size_t i = 0; i < rings_taken(); ++i) {
+        const Profiler_Ring *r = atomic_load(&rings[i]);
+        if (!r || r->count == 0) continue;
+        // The oldest span kept is the one about to be overwritten
+        uint64_t first = r->count > PROFILER_RING_SIZE ? r->count : 0;
+        uint64_t start = r->spans[first % PROFILER_RING_SIZE].start_ns;
+        if (start < origin) origin = start;
+    }
+
+    fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    const char *separator = "";
+    for (size_t i = 0; i < rings_taken(); ++i) {
+        const Profiler_Ring *r = atomic_load(&rings[i]);
+        if (!r) continue;
+        fprintf(fp,
+                "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+                "\"tid\": %d, \"args\": {\"name\": \"thread-%d\"}}",
+                separator, r->tid, r->tid);
+        separator = ",\n";
+
+        uint64_t first =
+            r->count > PROFILER_RING_SIZE ? r->count - PROFILER_RING_SIZE : 0;
+        for (uint64_t n = first; n < r->count; ++n) {
+            const Profiler_Span *span = &r->spans[n % PROFILER_RING_SIZE];
+            fprintf(fp,
+                    ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, "
+                    "\"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",
+                    profiler_phase_name(span->phase), r->tid,
+                    (span->start_ns - origin) / 1e3, span->duration_ns / 1e3);
+            if (span->arg >= 0)
+                fprintf(fp, ", \"args\": {\"client\": %d}", span->arg);
+            fputc('}', fp);
+        }
+    }
+    fprintf(fp, "\n]}\n");
+
+    int err = ferror(fp) ? -1 : 0;
+    if (fclose(fp) != 0) err = -1;
+    return err;
+}
+
+// Upper bound of the bucket the p-th fraction of the spans falls in, in ns
+static double bucket_percentile(const uint64_t *histogram, uint64_t count,
+                                double p)
+{
+    uint64_t rank = p * count, seen = 0;
+    for (unsigned b = 0; b < PROFILER_BUCKETS; ++b) {
+        seen += histogram[b];
+        if (seen > rank) return b ? (double)(1ULL << b) : 0.0;
+    }
+    return (double)(1ULL << (PROFILER_BUCKETS - 1));
+}
+
+/*
+ * Prints every phase across the rings: count, mean and max, the p50 and p99
+ * as bucket upper bounds, then the non empty buckets, each one labeled with
+ * its upper bound in us.
+ */
+void profiler_print_histograms(FILE *out)
+{
+    for (Profiler_Phase phase = 0; phase < PHASES_COUNT; ++phase) {
+        uint64_t histogram[PROFILER_BUCKETS] = {0};
+        uint64_t count = 0, total_ns = 0;
+        uint32_t max_ns = 0;
+
+        for (size_t i = 0; i < rings_taken(); ++i) {
+            const Profiler_Ring *r = atomic_load(&rings[i]);
+            if (!r) continue;
+            for (unsigned b = 0; b < PROFILER_BUCKETS; ++b) {
+                histogram[b] += r->histograms[phase][b];
+                count += r->histograms[phase][b];
+            }
+            total_ns += r->totals_ns[phase];
+            if (r->max_ns[phase] > max_ns) max_ns = r->max_ns[phase];
+        }
+        if (count == 0) continue;
+
+        fprintf(out,
+                "[INFO] Phase %-9s %8llu spans, mean %.2f us, p50 < %.2f us, "
+                "p99 < %.2f us, max %.2f us\n",
+                profiler_phase_name(phase), (unsigned long long)count,
+                total_ns / 1e3 / count,
+                bucket_percentile(histogram, count, 0.50) / 1e3,
+                bucket_percentile(histogram, count, 0.99) / 1e3, max_ns / 1e3);
+        fprintf(out, "[INFO]       %-9s", "");
+        for (unsigned b = 0; b < PROFILER_BUCKETS; ++b)
+            if (histogram[b])
+                fprintf(out, " <%g:%llu", (1ULL << b) / 1e3,
+                        (unsigned long long)histogram[b]);
+        fputc('\n', out);
+    }
+}
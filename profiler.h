@@ -0,0 +1,86 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+// Spans a ring keeps, the latest ones, a few seconds of a busy server
+#define PROFILER_RING_SIZE 65536
+// Threads that can record, each one gets its own ring on its first span
+#define PROFILER_THREADS   8
+// Power of two buckets of the span durations, 1 ns to ~4 s
+#define PROFILER_BUCKETS   32
+
+typedef enum {
+    PHASE_TICK,
+    PHASE_ACCEPT,
+    PHASE_READ,
+    PHASE_APPLY,
+    PHASE_UPDATE,
+    PHASE_SERIALIZE,
+    PHASE_BROADCAST,
+    PHASES_COUNT
+} Profiler_Phase;
+
+// A timed phase, `arg` is the client it ran for, -1 for none
+typedef struct {
+    uint64_t start_ns;
+    uint32_t duration_ns;
+    uint16_t phase;
+    int16_t arg;
+} Profiler_Span;
+
+/*
+ * Spans recorded by a single thread, no locking: the dump reads the rings
+ * as they are, it's meant to run on the recording thread or once the others
+ * are quiet. The histograms count every span since the start, not only the
+ * ones still in the ring.
+ */
+typedef struct {
+    Profiler_Span spans[PROFILER_RING_SIZE];
+    uint64_t count;
+    uint64_t histograms[PHASES_COUNT][PROFILER_BUCKETS];
+    uint64_t totals_ns[PHASES_COUNT];
+    uint32_t max_ns[PHASES_COUNT];
+    int tid;
+} Profiler_Ring;
+
+// Off by default, spans are only taken while it's set
+extern volatile bool profiler_enabled;
+
+static inline uint64_t profiler_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Brackets a phase, the start is 0 while profiling is off and the end is
+ * then a no-op, so a disabled timer costs a load and a branch:
+ *
+ *     uint64_t start = profiler_begin();
+ *     game_state_update(&game_state);
+ *     profiler_end(PHASE_UPDATE, -1, start);
+ */
+static inline uint64_t profiler_begin(void)
+{
+    return profiler_enabled ? profiler_now_ns() : 0;
+}
+
+void profiler_record(Profiler_Phase phase, int arg, uint64_t start_ns);
+
+static inline void profiler_end(Profiler_Phase phase, int arg,
+                                uint64_t start_ns)
+{
+    if (start_ns) profiler_record(phase, arg, start_ns);
+}
+
+const char *profiler_phase_name(Profiler_Phase phase);
+bool profiler_has_spans(void);
+int profiler_write_trace(const char *path);
+void profiler_print_histograms(FILE *out);
+
+#endif
@@ -6,8 +6,12 @@
  */
 #include "protocol.h"
 
-#define SIZEOF_TANK   sizeof(int) * 3 + sizeof(unsigned char) * 2
-#define SIZEOF_BULLET sizeof(int) * 2 + sizeof(unsigned char) * 2
+#include <stdint.h>
+#include <string.h>
+
+#define SIZEOF_TANK            SNAPSHOT_TANK_SIZE
+#define SIZEOF_BULLET          SNAPSHOT_BULLET_SIZE
+#define SIZEOF_SNAPSHOT_HEADER SNAPSHOT_HEADER_SIZE
 
 void bin_write_i32(unsigned char *buf, unsigned long val)
 {
@@ -33,195 +37,662 @@ long int bin_read_i32(const unsigned char *buf)
     return val;
 }
 
-static int protocol_serialize_bullet(const Bullet *bullet, unsigned char *buf)
+#define WIRE_WRITE_I32(p, v)     wire_write_i32(p, v)
+#define WIRE_WRITE_U8(p, v)      (*(p) = (v))
+#define WIRE_WRITE_PRESENT(p, v) ((void)(p), (void)(v))
+
+/*
+ * Encoders and decoders of the fixed layout records, generated from the
+ * schemas, a store or a load per field at a constant offset.
+ *
+ * Every entity on the wire is tagged with its slot in the game state, tanks
+ * with their player index, bullets with `owner * MAX_AMMO + slot`, so that
+ * only the live ones need to be sent.
+ */
+static int protocol_serialize_bullet(const Bullet *bullet, size_t id,
+                                     unsigned char *buf)
 {
-    bin_write_i32(buf, bullet->x);
-    buf += sizeof(int);
+    buf[BULLET_WIRE_ID] = id;
+#define ENCODE_FIELD(type, name, codec) \
+    WIRE_WRITE_##codec(buf + BULLET_WIRE_##name, bullet->name);
+    BULLET_FIELDS(ENCODE_FIELD)
+#undef ENCODE_FIELD
 
-    bin_write_i32(buf, bullet->y);
-    buf += sizeof(int);
+    return SIZEOF_BULLET;
+}
 
-    *buf++ = bullet->active;
-    *buf++ = bullet->direction;
+static int protocol_serialize_tank(const Tank *tank, size_t id,
+                                   unsigned char *buf)
+{
+    buf[TANK_WIRE_ID] = id;
+#define ENCODE_FIELD(type, name, codec) \
+    WIRE_WRITE_##codec(buf + TANK_WIRE_##name, tank->name);
+    TANK_FIELDS(ENCODE_FIELD)
+#undef ENCODE_FIELD
+
+    return SIZEOF_TANK;
+}
+
+static int protocol_deserialize_bullet(const unsigned char *buf,
+                                       Game_State *state)
+{
+    size_t id      = buf[BULLET_WIRE_ID];
+    Bullet *bullet = &state->players[id / MAX_AMMO].bullet[id % MAX_AMMO];
+#define DECODE_FIELD(type, name, codec) \
+    bullet->name = WIRE_READ_##codec(buf + BULLET_WIRE_##name);
+    BULLET_FIELDS(DECODE_FIELD)
+#undef DECODE_FIELD
 
     return SIZEOF_BULLET;
 }
 
-static int protocol_serialize_tank(const Tank *tank, unsigned char *buf)
+static int protocol_deserialize_tank(const unsigned char *buf,
+                                     Game_State *state)
 {
-    // Serialize the tank
-    bin_write_i32(buf, tank->x);
-    buf += sizeof(int);
+    size_t id  = buf[TANK_WIRE_ID];
+    Tank *tank = &state->players[id];
+#define DECODE_FIELD(type, name, codec) \
+    tank->name = WIRE_READ_##codec(buf + TANK_WIRE_##name);
+    TANK_FIELDS(DECODE_FIELD)
+#undef DECODE_FIELD
+
+    return SIZEOF_TANK;
+}
 
-    bin_write_i32(buf, tank->y);
-    buf += sizeof(int);
+/*
+ * The serialized binary representation of the game state:
+ *
+ * Variable length, only alive tanks and active bullets are written, each one
+ * prefixed by its slot id; everything not listed is dead or inactive.
+ * Legacy connections receive it right after the total length, versioned ones
+ * after the frame header (total length + MSG_SNAPSHOT, + the ack, its ticks
+ * and the tick from PROTOCOL_VERSION_SEQUENCED on).
+ *
+ * - header, SNAPSHOT_HEADER_FIELDS followed by the tanks count (T)
+ * - T tank records, the id followed by TANK_FIELDS
+ * - the bullets count (B)
+ * - B bullet records, the id followed by BULLET_FIELDS
+ *
+ * The exact offsets are generated from the schemas, protocol_dump_layout()
+ * prints them.
+ */
+static int serialize_snapshot_body(const Game_State *state, unsigned char *buf)
+{
+#define ENCODE_FIELD(type, name, member, codec) \
+    WIRE_WRITE_##codec(buf + SNAPSHOT_WIRE_##name, state->member);
+    SNAPSHOT_HEADER_FIELDS(ENCODE_FIELD)
+#undef ENCODE_FIELD
+
+    // Serialize the alive tanks
+    int offset           = SIZEOF_SNAPSHOT_HEADER;
+    unsigned char *count = buf + SNAPSHOT_WIRE_TANKS_COUNT;
+    *count               = 0;
+    for (size_t i = 0; i < MAX_PLAYERS; i++) {
+        if (!state->players[i].alive) continue;
+        offset += protocol_serialize_tank(&state->players[i], i, buf + offset);
+        (*count)++;
+    }
 
-    bin_write_i32(buf, tank->hp);
-    buf += sizeof(int);
+    // Serialize the active bullets
+    count  = buf + offset++;
+    *count = 0;
+    for (size_t i = 0; i < MAX_PLAYERS; i++) {
+        for (size_t j = 0; j < MAX_AMMO; ++j) {
+            const Bullet *bullet = &state->players[i].bullet[j];
+            if (!bullet->active) continue;
+            offset += protocol_serialize_bullet(bullet, i * MAX_AMMO + j,
+                                                buf + offset);
+            (*count)++;
+        }
+    }
+
+    return offset;
+}
+
+static void deserialize_snapshot_body(const unsigned char *buf,
+                                      Game_State *state)
+{
+#define DECODE_FIELD(type, name, member, codec) \
+    state->member = WIRE_READ_##codec(buf + SNAPSHOT_WIRE_##name);
+    SNAPSHOT_HEADER_FIELDS(DECODE_FIELD)
+#undef DECODE_FIELD
 
-    *buf++     = tank->alive;
-    *buf++     = tank->direction;
+    // Anything not listed in the snapshot is either dead or inactive
+    for (size_t i = 0; i < MAX_PLAYERS; ++i) {
+        state->players[i].alive = false;
+        for (size_t j = 0; j < MAX_AMMO; ++j)
+            state->players[i].bullet[j].active = false;
+    }
 
-    // Serialize the bullet
-    int offset = 0;
-    for (int i = 0; i < MAX_AMMO; ++i)
-        offset += protocol_serialize_bullet(&tank->bullet[i], buf + offset);
+    // Deserialize the alive tanks
+    size_t count = buf[SNAPSHOT_WIRE_TANKS_COUNT];
+    buf += SIZEOF_SNAPSHOT_HEADER;
+    for (size_t i = 0; i < count; ++i)
+        buf += protocol_deserialize_tank(buf, state);
 
-    return offset + SIZEOF_TANK;
+    // Deserialize the active bullets
+    count = *buf++;
+    for (size_t i = 0; i < count; ++i)
+        buf += protocol_deserialize_bullet(buf, state);
 }
 
-static int protocol_deserialize_bullet(const unsigned char *buf, Bullet *bullet)
+int protocol_serialize_game_state(const Game_State *state, unsigned char *buf)
 {
-    bullet->x = bin_read_i32(buf);
-    buf += sizeof(int);
+    // Total length will include itself in the full length of the packet, it's
+    // written last once the number of live entities is known
+    int total_length =
+        sizeof(int) + serialize_snapshot_body(state, buf + sizeof(int));
+    bin_write_i32(buf, total_length);
+    return total_length;
+}
 
-    bullet->y = bin_read_i32(buf);
-    buf += sizeof(int);
+/*
+ * Decoders take the frame as received and its length, the whole frame is
+ * validated up front so the decoding itself runs with no checks. They
+ * return the frame length or -1 if the frame is malformed, in which case the
+ * output is left untouched.
+ */
+int protocol_deserialize_game_state(const unsigned char *buf, size_t len,
+                                    Game_State *state)
+{
+    Snapshot_View view;
+    if (protocol_snapshot_view(buf, len, PROTOCOL_VERSION_LEGACY, &view) < 0)
+        return -1;
 
-    bullet->active    = *buf++;
-    bullet->direction = *buf++;
+    deserialize_snapshot_body(view.body, state);
+    return len;
+}
 
-    return SIZEOF_BULLET;
+int protocol_serialize_action(unsigned action, unsigned char *buf)
+{
+    // Total length will include itself in the full length of the packet
+    int total_length = sizeof(int) + sizeof(unsigned char);
+
+    bin_write_i32(buf, total_length);
+    int offset      = sizeof(int);
+
+    *(buf + offset) = action;
+    return total_length;
+}
+
+static bool is_action(unsigned action)
+{
+    return action <= RIGHT || action == FIRE;
+}
+
+int protocol_deserialize_action(const unsigned char *buf, size_t len,
+                                unsigned *action)
+{
+    if (len != sizeof(int) + sizeof(unsigned char)) return -1;
+    if ((size_t)bin_read_i32(buf) != len) return -1;
+    if (!is_action(buf[sizeof(int)])) return -1;
+
+    *action = buf[sizeof(int)];
+    return len;
+}
+
+/*
+ * Hello frame, the first message sent by versioned clients and the server
+ * reply to it, the reply carries the negotiated settings and the tank
+ * assigned to the player.
+ *
+ * bytes (1-4)     total packet length (17 bytes)
+ * bytes (5-8)     magic "BTNK"
+ * byte  (9)       protocol version
+ * bytes (10-13)   capabilities bitmask
+ * bytes (14-17)   player index (server reply only)
+ */
+#define SIZEOF_HELLO (sizeof(int) * 4 + sizeof(unsigned char))
+
+bool protocol_is_hello(const unsigned char *buf, size_t len)
+{
+    return len == SIZEOF_HELLO && bin_read_i32(buf) == SIZEOF_HELLO &&
+           (unsigned long)bin_read_i32(buf + sizeof(int)) == PROTOCOL_MAGIC;
 }
 
-static int protocol_deserialize_tank(const unsigned char *buf, Tank *tank)
+int protocol_serialize_hello(const Hello *hello, unsigned char *buf)
 {
-    tank->x = bin_read_i32(buf);
+    bin_write_i32(buf, SIZEOF_HELLO);
     buf += sizeof(int);
 
-    tank->y = bin_read_i32(buf);
+    bin_write_i32(buf, PROTOCOL_MAGIC);
     buf += sizeof(int);
 
-    tank->hp = bin_read_i32(buf);
+    *buf++ = hello->version;
+
+    bin_write_i32(buf, hello->caps);
     buf += sizeof(int);
 
-    tank->alive     = *buf++;
-    tank->direction = *buf++;
+    bin_write_i32(buf, hello->player_index);
+
+    return SIZEOF_HELLO;
+}
+
+int protocol_deserialize_hello(const unsigned char *buf, size_t len,
+                               Hello *hello)
+{
+    if (!protocol_is_hello(buf, len)) return -1;
+    buf += sizeof(int) * 2;
+
+    hello->version = *buf++;
+
+    hello->caps    = bin_read_i32(buf);
+    buf += sizeof(int);
 
-    int offset      = 0;
-    for (int i = 0; i < MAX_AMMO; ++i)
-        offset += protocol_deserialize_bullet(buf + offset, &tank->bullet[i]);
+    hello->player_index = bin_read_i32(buf);
 
-    return offset + SIZEOF_TANK;
+    return SIZEOF_HELLO;
 }
 
 /*
- * The serialized binary representation of the game state:
- *
- * The structure is simple enough for the time being, just a
- * players count followed by the tanks, each tank has only a
- * single bullet.
- *
- * Header
- * ------
- * bytes (1-4)     total packet length (54 bytes)
- * bytes (5-9)     player index
- * bytes (10-14)   active players count
- * bytes (15-19)   active power-up x
- * bytes (20-24)   active power-up y
- * bytes (25)      power-up kind
- *
- * State (suppose 1 tank)
- * -----
- * For each player (e.g. <players count> players)
- * bytes (26-30)   x
- * bytes (31-35)   y
- * bytes (36-40)   hp
- * bytes (41)      alive
- * bytes (42)      direction
- *
- * Bullet
- * ------
- * bytes (43-47)   x
- * bytes (48-52)   y
- * bytes (53)      active
- * bytes (54)      direction
+ * Settles the version and the features for a connection, the highest version
+ * spoken by both peers and the capabilities both of them support. Players
+ * with different builds can share the same match, each one on its own
+ * settings.
  */
-int protocol_serialize_game_state(const Game_State *state, unsigned char *buf)
+void protocol_negotiate(const Hello *local, const Hello *remote, Hello *agreed)
 {
-    // Serialize the game state header
-    int active_players = state->active_players;
-    // Total length will include itself in the full length of the packet
-    int total_length =
-        ((SIZEOF_TANK + (SIZEOF_BULLET * MAX_AMMO)) * MAX_PLAYERS) +
-        (sizeof(int) * 5) + sizeof(unsigned char);
+    agreed->version = local->version < remote->version ? local->version
+                                                       : remote->version;
+    agreed->caps    = local->caps & remote->caps;
+    if (agreed->version < PROTOCOL_VERSION_TYPED) agreed->caps = 0;
+}
 
+// MSG_INVALID for frames too short to carry a type
+Message_Type protocol_message_type(const unsigned char *buf, size_t len)
+{
+    if (len < sizeof(int) + sizeof(unsigned char)) return MSG_INVALID;
+    return buf[sizeof(int)];
+}
+
+/*
+ * Versioned snapshots and commands (actions and inputs) share the frame
+ * header, the length and the type, from PROTOCOL_VERSION_SEQUENCED on
+ * followed by a 4 bytes sequence number. Clients number their commands from
+ * 1 on, a snapshot carries the sequence of the last command of its receiver
+ * applied to it and the number of updates run since then (4 more bytes), set
+ * per connection with protocol_snapshot_set_ack(), followed by the tick of
+ * the game state (4 more bytes). From PROTOCOL_VERSION_REWIND on commands
+ * carry the tick of the game state their sender was looking at right after
+ * the sequence, the server rewinds to it to check the hits of a fire.
+ */
+static size_t message_header(unsigned version)
+{
+    size_t header = sizeof(int) + sizeof(unsigned char);
+    if (version >= PROTOCOL_VERSION_SEQUENCED) header += sizeof(int);
+    return header;
+}
+
+static size_t command_header(unsigned version)
+{
+    size_t header = message_header(version);
+    if (version >= PROTOCOL_VERSION_REWIND) header += sizeof(int);
+    return header;
+}
+
+static size_t snapshot_header(unsigned version)
+{
+    if (version == PROTOCOL_VERSION_LEGACY) return sizeof(int);
+    size_t header = message_header(version);
+    if (version >= PROTOCOL_VERSION_SEQUENCED) header += sizeof(int) * 2;
+    return header;
+}
+
+int protocol_serialize_snapshot(const Game_State *state, unsigned version,
+                                unsigned char *buf)
+{
+    size_t header    = snapshot_header(version);
+    buf[sizeof(int)] = MSG_SNAPSHOT;
+    if (version >= PROTOCOL_VERSION_SEQUENCED) {
+        protocol_snapshot_set_ack(buf, 0, 0);
+        bin_write_i32(buf + header - sizeof(int), state->tick);
+    }
+    int total_length = header + serialize_snapshot_body(state, buf + header);
     bin_write_i32(buf, total_length);
-    int offset = sizeof(int);
+    return total_length;
+}
 
-    // Player index
-    bin_write_i32(buf + offset, state->player_index);
-    offset += sizeof(int);
+// PROTOCOL_VERSION_SEQUENCED snapshots only
+void protocol_snapshot_set_ack(unsigned char *buf, uint32_t sequence,
+                               uint32_t ticks)
+{
+    buf += sizeof(int) + sizeof(unsigned char);
+    bin_write_i32(buf, sequence);
+    bin_write_i32(buf + sizeof(int), ticks);
+}
 
-    // Players count
-    bin_write_i32(buf + offset, active_players);
-    offset += sizeof(int);
+int protocol_deserialize_snapshot(const unsigned char *buf, size_t len,
+                                  unsigned version, Game_State *state)
+{
+    Snapshot_View view;
+    if (protocol_snapshot_view(buf, len, version, &view) < 0) return -1;
 
-    // Power up
-    bin_write_i32(buf + offset, state->power_up.x);
-    offset += sizeof(int);
+    deserialize_snapshot_body(view.body, state);
+    return len;
+}
 
-    bin_write_i32(buf + offset, state->power_up.y);
-    offset += sizeof(int);
+static int serialize_command(Message_Type type, unsigned value,
+                             unsigned version, uint32_t sequence,
+                             uint32_t tick, unsigned char *buf)
+{
+    size_t header    = command_header(version);
+    int total_length = header + sizeof(unsigned char);
+    unsigned char *p = buf + sizeof(int) + sizeof(unsigned char);
 
-    *(buf + offset) = state->power_up.kind;
-    offset++;
+    bin_write_i32(buf, total_length);
+    buf[sizeof(int)] = type;
+    if (version >= PROTOCOL_VERSION_SEQUENCED) bin_write_i32(p, sequence);
+    if (version >= PROTOCOL_VERSION_REWIND) bin_write_i32(p + sizeof(int), tick);
+    buf[header] = value;
 
-    // Serialize each player
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        offset += protocol_serialize_tank(&state->players[i], buf + offset);
-    }
+    return total_length;
+}
 
-    return offset;
+// The sequence is 0 for connections older than PROTOCOL_VERSION_SEQUENCED,
+// the tick for those older than PROTOCOL_VERSION_REWIND
+static int deserialize_command(const unsigned char *buf, size_t len,
+                               Message_Type type, unsigned version,
+                               unsigned *value, uint32_t *sequence,
+                               uint32_t *tick)
+{
+    size_t header          = command_header(version);
+    const unsigned char *p = buf + sizeof(int) + sizeof(unsigned char);
+    if (len != header + sizeof(unsigned char)) return -1;
+    if ((size_t)bin_read_i32(buf) != len) return -1;
+    if (protocol_message_type(buf, len) != type) return -1;
+
+    *sequence = *tick = 0;
+    if (version >= PROTOCOL_VERSION_SEQUENCED) *sequence = bin_read_i32(p);
+    if (version >= PROTOCOL_VERSION_REWIND) *tick = bin_read_i32(p + sizeof(int));
+    *value = buf[header];
+    return len;
 }
 
-int protocol_deserialize_game_state(const unsigned char *buf, Game_State *state)
+int protocol_serialize_action_message(unsigned action, unsigned version,
+                                      uint32_t sequence, uint32_t tick,
+                                      unsigned char *buf)
 {
-    // Deserialize the game state header
-    int total_length = bin_read_i32(buf);
-    buf += sizeof(int);
+    return serialize_command(MSG_ACTION, action, version, sequence, tick, buf);
+}
 
-    state->player_index = bin_read_i32(buf);
-    buf += sizeof(int);
+int protocol_deserialize_action_message(const unsigned char *buf, size_t len,
+                                        unsigned version, unsigned *action,
+                                        uint32_t *sequence, uint32_t *tick)
+{
+    unsigned value;
+    uint32_t number, seen;
+    if (deserialize_command(buf, len, MSG_ACTION, version, &value, &number,
+                            &seen) < 0)
+        return -1;
+    if (!is_action(value)) return -1;
+
+    *action   = value;
+    *sequence = number;
+    *tick     = seen;
+    return len;
+}
 
-    state->active_players = bin_read_i32(buf);
-    buf += sizeof(int);
+/*
+ * Held input, negotiated with CAP_INPUT, replaces the action messages: sent
+ * only when the input changes, the Input bitmask right after the header.
+ */
+int protocol_serialize_input(unsigned input, unsigned version,
+                             uint32_t sequence, uint32_t tick,
+                             unsigned char *buf)
+{
+    return serialize_command(MSG_INPUT, input, version, sequence, tick, buf);
+}
 
-    state->power_up.x = bin_read_i32(buf);
-    buf += sizeof(int);
+int protocol_deserialize_input(const unsigned char *buf, size_t len,
+                               unsigned version, unsigned *input,
+                               uint32_t *sequence, uint32_t *tick)
+{
+    unsigned value;
+    uint32_t number, seen;
+    if (deserialize_command(buf, len, MSG_INPUT, version, &value, &number,
+                            &seen) < 0)
+        return -1;
+    if (value & ~INPUT_MASK) return -1;
+
+    *input    = value;
+    *sequence = number;
+    *tick     = seen;
+    return len;
+}
 
-    state->power_up.y = bin_read_i32(buf);
-    buf += sizeof(int);
+/*
+ * Round trip probes, negotiated with CAP_PING: the client sends a ping
+ * stamped with its own clock, the server echoes the stamp right back in a
+ * pong, the stamp is opaque to it. Frames carry no sequence nor tick, they
+ * don't go through the command ordering.
+ *
+ * bytes (1-4)     total packet length (9 bytes)
+ * byte  (5)       MSG_PING or MSG_PONG
+ * bytes (6-9)     stamp
+ */
+#define SIZEOF_PING (sizeof(int) * 2 + sizeof(unsigned char))
 
-    state->power_up.kind = *buf++;
+int protocol_serialize_ping(Message_Type type, uint32_t stamp,
+                            unsigned char *buf)
+{
+    bin_write_i32(buf, SIZEOF_PING);
+    buf[sizeof(int)] = type;
+    bin_write_i32(buf + sizeof(int) + sizeof(unsigned char), stamp);
+    return SIZEOF_PING;
+}
 
-    int offset           = 0;
+int protocol_deserialize_ping(const unsigned char *buf, size_t len,
+                              Message_Type type, uint32_t *stamp)
+{
+    if (len != SIZEOF_PING) return -1;
+    if ((size_t)bin_read_i32(buf) != len) return -1;
+    if (protocol_message_type(buf, len) != type) return -1;
 
-    // Deserialize the players
-    for (size_t i = 0; i < MAX_PLAYERS; ++i) {
-        offset += protocol_deserialize_tank(buf + offset, &state->players[i]);
+    *stamp = bin_read_i32(buf + sizeof(int) + sizeof(unsigned char));
+    return len;
+}
+
+/*
+ * Entity events, sent to connections with CAP_ENTITIES ahead of the snapshot
+ * they apply to, list the entities spawned and despawned since the previous
+ * one. Snapshot records keep addressing entities by slot, they update the
+ * entity the last spawn record put in that slot.
+ *
+ * bytes (1-4)     total packet length
+ * byte  (5)       MSG_ENTITY_EVENTS
+ * byte  (6)       records count (N)
+ * N records       ENTITY_EVENT_FIELDS, see protocol_dump_layout()
+ */
+#define SIZEOF_ENTITY_EVENTS_HEADER (sizeof(int) + sizeof(unsigned char) * 2)
+
+int protocol_serialize_entity_events(const Entity_Event *events, size_t count,
+                                     unsigned char *buf)
+{
+    buf[sizeof(int)]     = MSG_ENTITY_EVENTS;
+    buf[sizeof(int) + 1] = count;
+
+    unsigned char *record = buf + SIZEOF_ENTITY_EVENTS_HEADER;
+    for (size_t i = 0; i < count; ++i, record += ENTITY_EVENT_SIZE) {
+#define ENCODE_FIELD(type, name, codec) \
+    WIRE_WRITE_##codec(record + EVENT_WIRE_##name, events[i].name);
+        ENTITY_EVENT_FIELDS(ENCODE_FIELD)
+#undef ENCODE_FIELD
     }
 
+    int total_length = record - buf;
+    bin_write_i32(buf, total_length);
     return total_length;
 }
 
-int protocol_serialize_action(unsigned action, unsigned char *buf)
+static bool is_entity_event(const Entity_Event *event)
 {
-    // Total length will include itself in the full length of the packet
-    int total_length = sizeof(int) + sizeof(unsigned char);
+    if (event->event != ENTITY_SPAWN && event->event != ENTITY_DESPAWN)
+        return false;
+    if (event->kind >= ENTITY_KINDS) return false;
+    return ENTITY_GENERATION(event->handle) != 0 &&
+           ENTITY_SLOT(event->handle) < entity_table_slots(event->kind);
+}
 
-    bin_write_i32(buf, total_length);
-    int offset      = sizeof(int);
+int protocol_deserialize_entity_events(const unsigned char *buf, size_t len,
+                                       Entity_Event *events, size_t *count)
+{
+    if (len < SIZEOF_ENTITY_EVENTS_HEADER) return -1;
+    if ((size_t)bin_read_i32(buf) != len) return -1;
+    if (protocol_message_type(buf, len) != MSG_ENTITY_EVENTS) return -1;
+
+    size_t n = buf[sizeof(int) + 1];
+    if (n > ENTITY_EVENTS_MAX) return -1;
+    if (len != SIZEOF_ENTITY_EVENTS_HEADER + n * ENTITY_EVENT_SIZE) return -1;
+
+    const unsigned char *record = buf + SIZEOF_ENTITY_EVENTS_HEADER;
+    for (size_t i = 0; i < n; ++i, record += ENTITY_EVENT_SIZE) {
+#define DECODE_FIELD(type, name, codec) \
+    events[i].name = WIRE_READ_##codec(record + EVENT_WIRE_##name);
+        ENTITY_EVENT_FIELDS(DECODE_FIELD)
+#undef DECODE_FIELD
+        if (!is_entity_event(&events[i])) return -1;
+    }
 
-    *(buf + offset) = action;
-    return total_length;
+    *count = n;
+    return len;
 }
 
-int protocol_deserialize_action(const unsigned char *buf, unsigned *action)
+/*
+ * Compressed snapshots, negotiated with CAP_COMPRESS, carry whatever follows
+ * the type of a MSG_SNAPSHOT frame (the ack included) encoded against the
+ * previous snapshot exchanged on the connection, see compress.c. The context
+ * must be used for every snapshot sent (or received) on the connection, in
+ * order.
+ */
+int protocol_compress_snapshot(Compress_Context *ctx,
+                               const unsigned char *frame, unsigned char *buf)
 {
-    int total_length = bin_read_i32(buf);
-    buf += sizeof(int);
+    const size_t header = sizeof(int) + sizeof(unsigned char);
+    size_t len          = bin_read_i32(frame);
 
-    *action = *buf;
+    buf[sizeof(int)]    = MSG_SNAPSHOT_COMPRESSED;
+    int total_length =
+        header + compress_encode(ctx, frame + header, len - header, buf + header);
+    bin_write_i32(buf, total_length);
     return total_length;
 }
+
+/*
+ * Restores the MSG_SNAPSHOT frame from a compressed one into `buf`, returns
+ * its length or -1 if the frame can't be decoded.
+ */
+int protocol_decompress_snapshot(Compress_Context *ctx,
+                                 const unsigned char *frame, size_t len,
+                                 unsigned char *buf, size_t capacity)
+{
+    const size_t header = sizeof(int) + sizeof(unsigned char);
+    if (len < header || capacity < header) return -1;
+    if ((size_t)bin_read_i32(frame) != len) return -1;
+    if (protocol_message_type(frame, len) != MSG_SNAPSHOT_COMPRESSED)
+        return -1;
+
+    int n = compress_decode(ctx, frame + header, len - header, buf + header,
+                            capacity - header);
+    if (n < 0) return -1;
+
+    buf[sizeof(int)] = MSG_SNAPSHOT;
+    bin_write_i32(buf, header + n);
+    return header + n;
+}
+
+/*
+ * Sets up a view over a snapshot frame of `len` bytes, as received from a
+ * connection speaking `version`. Everything the accessors and the decoders
+ * rely on is checked here: the length prefix, the player index, the entity
+ * counts against the actual frame size and the entity ids, so that the live
+ * entities can be walked with no further checks and no copy.
+ *
+ * Returns 0 on success, -1 if the frame is not a well formed snapshot.
+ */
+int protocol_snapshot_view(const unsigned char *buf, size_t len,
+                           unsigned version, Snapshot_View *view)
+{
+    size_t header = snapshot_header(version);
+
+    if (len < header + SIZEOF_SNAPSHOT_HEADER + 1) return -1;
+    if ((size_t)bin_read_i32(buf) != len) return -1;
+    if (version != PROTOCOL_VERSION_LEGACY &&
+        protocol_message_type(buf, len) != MSG_SNAPSHOT)
+        return -1;
+
+    view->ack = view->ack_ticks = view->tick = 0;
+    if (version >= PROTOCOL_VERSION_SEQUENCED) {
+        const unsigned char *ack = buf + sizeof(int) + sizeof(unsigned char);
+        view->ack                = bin_read_i32(ack);
+        view->ack_ticks          = bin_read_i32(ack + sizeof(int));
+        view->tick               = bin_read_i32(ack + sizeof(int) * 2);
+    }
+    view->body = buf + header;
+    if (snapshot_view_player_index(view) >= MAX_PLAYERS) return -1;
+
+    view->tanks_count = view->body[SNAPSHOT_WIRE_TANKS_COUNT];
+    view->tanks       = view->body + SIZEOF_SNAPSHOT_HEADER;
+    if (view->tanks_count > MAX_PLAYERS) return -1;
+
+    size_t offset = header + SIZEOF_SNAPSHOT_HEADER +
+                    view->tanks_count * SIZEOF_TANK;
+    if (len < offset + 1) return -1;
+
+    view->bullets_count = buf[offset];
+    view->bullets       = buf + offset + 1;
+    if (view->bullets_count > MAX_PLAYERS * MAX_AMMO) return -1;
+    if (len != offset + 1 + view->bullets_count * SIZEOF_BULLET) return -1;
+
+    for (size_t i = 0; i < view->tanks_count; ++i)
+        if (view->tanks[i * SIZEOF_TANK + TANK_WIRE_ID] >= MAX_PLAYERS)
+            return -1;
+
+    for (size_t i = 0; i < view->bullets_count; ++i)
+        if (view->bullets[i * SIZEOF_BULLET + BULLET_WIRE_ID] >=
+            MAX_PLAYERS * MAX_AMMO)
+            return -1;
+
+    return 0;
+}
+
+/*
+ * Prints the wire layout of the snapshot as generated from the schemas, one
+ * line per field with its offset within the header or record, its size and
+ * codec.
+ */
+void protocol_dump_layout(FILE *fp)
+{
+    fprintf(fp, "snapshot header (%d bytes)\n", SIZEOF_SNAPSHOT_HEADER);
+#define DUMP_FIELD(type, name, member, codec)                   \
+    fprintf(fp, "  %-16s %3d %3d  %s\n", #name, SNAPSHOT_WIRE_##name, \
+            WIRE_SIZE_##codec, #codec);
+    SNAPSHOT_HEADER_FIELDS(DUMP_FIELD)
+#undef DUMP_FIELD
+    fprintf(fp, "  %-16s %3d %3d  %s\n", "tanks_count",
+            SNAPSHOT_WIRE_TANKS_COUNT, WIRE_SIZE_U8, "U8");
+
+    fprintf(fp, "tank record (%d bytes)\n", SIZEOF_TANK);
+    fprintf(fp, "  %-16s %3d %3d  %s\n", "id", TANK_WIRE_ID, WIRE_SIZE_U8,
+            "U8");
+#define DUMP_FIELD(type, name, codec)                                      \
+    fprintf(fp, "  %-16s %3d %3d  %s\n", #name, TANK_WIRE_##name,          \
+            WIRE_SIZE_##codec, #codec);
+    TANK_FIELDS(DUMP_FIELD)
+#undef DUMP_FIELD
+
+    fprintf(fp, "bullet record (%d bytes)\n", SIZEOF_BULLET);
+    fprintf(fp, "  %-16s %3d %3d  %s\n", "id", BULLET_WIRE_ID, WIRE_SIZE_U8,
+            "U8");
+#define DUMP_FIELD(type, name, codec)                                      \
+    fprintf(fp, "  %-16s %3d %3d  %s\n", #name, BULLET_WIRE_##name,        \
+            WIRE_SIZE_##codec, #codec);
+    BULLET_FIELDS(DUMP_FIELD)
+#undef DUMP_FIELD
+
+    fprintf(fp, "entity event record (%d bytes)\n", ENTITY_EVENT_SIZE);
+#define DUMP_FIELD(type, name, codec)                                      \
+    fprintf(fp, "  %-16s %3d %3d  %s\n", #name, EVENT_WIRE_##name,         \
+            WIRE_SIZE_##codec, #codec);
+    ENTITY_EVENT_FIELDS(DUMP_FIELD)
+#undef DUMP_FIELD
+}
@@ -1,16 +1,259 @@
 #ifndef PROTOCOL_H
 #define PROTOCOL_H
 
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
+#include "compress.h"
 #include "game_state.h"
 
+// Versioned connections open with a hello frame carrying this magic right
+// after the length, which can't be mistaken for a legacy action or snapshot
+#define PROTOCOL_MAGIC             0x42544e4b  // "BTNK"
+#define PROTOCOL_VERSION_LEGACY    1
+// Typed frames and capabilities
+#define PROTOCOL_VERSION_TYPED     2
+// Sequence numbers on the inputs, acknowledged in the snapshots
+#define PROTOCOL_VERSION_SEQUENCED 3
+// Commands carry the tick of the game state the player was looking at
+#define PROTOCOL_VERSION_REWIND    4
+#define PROTOCOL_VERSION           PROTOCOL_VERSION_REWIND
+
+// Optional encodings and features a peer can advertise in the hello, the
+// server picks the common subset for each connection
+typedef enum {
+    CAP_DELTA     = 1 << 0,
+    CAP_BITPACK   = 1 << 1,
+    CAP_COMPRESS  = 1 << 2,
+    CAP_TRANSPORT = 1 << 3,
+    CAP_ENTITIES  = 1 << 4,
+    CAP_INPUT     = 1 << 5,
+    CAP_PING      = 1 << 6,
+} Capability;
+
+// Capabilities implemented by this build
+#define PROTOCOL_CAPS (CAP_COMPRESS | CAP_ENTITIES | CAP_INPUT | CAP_PING)
+
+// From PROTOCOL_VERSION_TYPED on, every frame after the hello carries its
+// type right after the length
+typedef enum {
+    MSG_INVALID,
+    MSG_SNAPSHOT,
+    MSG_ACTION,
+    MSG_SNAPSHOT_COMPRESSED,
+    MSG_ENTITY_EVENTS,
+    MSG_INPUT,
+    MSG_PING,
+    MSG_PONG
+} Message_Type;
+
+typedef struct {
+    unsigned version;
+    unsigned caps;
+    size_t player_index;
+} Hello;
+
+// Read-only view over a received snapshot frame, entities are read straight
+// from the frame buffer, which must outlive the view. `ack` is the sequence
+// of the last command of the player applied to the snapshot, `ack_ticks` the
+// updates run since and `tick` the one of the game state, all 0 before
+// PROTOCOL_VERSION_SEQUENCED.
+typedef struct {
+    uint32_t ack;
+    uint32_t ack_ticks;
+    uint32_t tick;
+    const unsigned char *body;
+    const unsigned char *tanks;
+    const unsigned char *bullets;
+    size_t tanks_count;
+    size_t bullets_count;
+} Snapshot_View;
+
 void bin_write_i32(unsigned char *buf, unsigned long val);
 long int bin_read_i32(const unsigned char *buf);
 int protocol_serialize_action(unsigned action, unsigned char *buf);
-int protocol_deserialize_action(const unsigned char *buf, unsigned *action);
+int protocol_deserialize_action(const unsigned char *buf, size_t len,
+                                unsigned *action);
 int protocol_serialize_game_state(const Game_State *state, unsigned char *buf);
-int protocol_deserialize_game_state(const unsigned char *buf,
+int protocol_deserialize_game_state(const unsigned char *buf, size_t len,
                                     Game_State *state);
 
+// Handshake and versioned messages
+bool protocol_is_hello(const unsigned char *buf, size_t len);
+int protocol_serialize_hello(const Hello *hello, unsigned char *buf);
+int protocol_deserialize_hello(const unsigned char *buf, size_t len,
+                               Hello *hello);
+void protocol_negotiate(const Hello *local, const Hello *remote,
+                        Hello *agreed);
+Message_Type protocol_message_type(const unsigned char *buf, size_t len);
+int protocol_serialize_snapshot(const Game_State *state, unsigned version,
+                                unsigned char *buf);
+void protocol_snapshot_set_ack(unsigned char *buf, uint32_t sequence,
+                               uint32_t ticks);
+int protocol_deserialize_snapshot(const unsigned char *buf, size_t len,
+                                  unsigned version, Game_State *state);
+int protocol_serialize_action_message(unsigned action, unsigned version,
+                                      uint32_t sequence, uint32_t tick,
+                                      unsigned char *buf);
+int protocol_deserialize_action_message(const unsigned char *buf, size_t len,
+                                        unsigned version, unsigned *action,
+                                        uint32_t *sequence, uint32_t *tick);
+int protocol_serialize_input(unsigned input, unsigned version,
+                             uint32_t sequence, uint32_t tick,
+                             unsigned char *buf);
+int protocol_deserialize_input(const unsigned char *buf, size_t len,
+                               unsigned version, unsigned *input,
+                               uint32_t *sequence, uint32_t *tick);
+int protocol_serialize_ping(Message_Type type, uint32_t stamp,
+                            unsigned char *buf);
+int protocol_deserialize_ping(const unsigned char *buf, size_t len,
+                              Message_Type type, uint32_t *stamp);
+int protocol_compress_snapshot(Compress_Context *ctx,
+                               const unsigned char *frame, unsigned char *buf);
+int protocol_decompress_snapshot(Compress_Context *ctx,
+                                 const unsigned char *frame, size_t len,
+                                 unsigned char *buf, size_t capacity);
+
+// Spawn and despawn records, negotiated with CAP_ENTITIES
+int protocol_serialize_entity_events(const Entity_Event *events, size_t count,
+                                     unsigned char *buf);
+int protocol_deserialize_entity_events(const unsigned char *buf, size_t len,
+                                       Entity_Event *events, size_t *count);
+
+// Zero-copy snapshot access, the frame is validated once by
+// protocol_snapshot_view, the accessors then do no checks at all
+int protocol_snapshot_view(const unsigned char *buf, size_t len,
+                           unsigned version, Snapshot_View *view);
+
+/*
+ * Wire layout of the snapshot records, generated from the schemas: offsets
+ * are enumerators, so every record is a fixed compile-time layout. Each
+ * field gets an enumerator for its first byte and one for its last, the
+ * next field starting right after. Tank and bullet records begin with a
+ * single byte id, entity event records have none.
+ */
+#define WIRE_SIZE_I32     4
+#define WIRE_SIZE_U8      1
+#define WIRE_SIZE_PRESENT 0
+
+// Snapshot header, X(type, name, Game_State member, wire codec)
+#define SNAPSHOT_HEADER_FIELDS(X)                        \
+    X(size_t, player_index, player_index, I32)          \
+    X(size_t, active_players, active_players, I32)      \
+    X(int, power_up_x, power_up.x, I32)                 \
+    X(int, power_up_y, power_up.y, I32)                 \
+    X(Power_Up, power_up_kind, power_up.kind, U8)
+
+// Spawn and despawn record, X(type, Entity_Event member, wire codec)
+#define ENTITY_EVENT_FIELDS(X)      \
+    X(Entity_Event_Kind, event, U8) \
+    X(Entity_Kind, kind, U8)        \
+    X(Entity_Handle, handle, I32)
+
+#define HEADER_WIRE_OFFSET(type, name, member, codec) \
+    SNAPSHOT_WIRE_##name,                             \
+        SNAPSHOT_WIRE_##name##_END = SNAPSHOT_WIRE_##name + WIRE_SIZE_##codec - 1,
+#define TANK_WIRE_OFFSET(type, name, codec) \
+    TANK_WIRE_##name,                       \
+        TANK_WIRE_##name##_END = TANK_WIRE_##name + WIRE_SIZE_##codec - 1,
+#define BULLET_WIRE_OFFSET(type, name, codec) \
+    BULLET_WIRE_##name,                       \
+        BULLET_WIRE_##name##_END = BULLET_WIRE_##name + WIRE_SIZE_##codec - 1,
+#define EVENT_WIRE_OFFSET(type, name, codec) \
+    EVENT_WIRE_##name,                       \
+        EVENT_WIRE_##name##_END = EVENT_WIRE_##name + WIRE_SIZE_##codec - 1,
+
+// Snapshot body up to and including the tanks count
+enum {
+    SNAPSHOT_HEADER_FIELDS(HEADER_WIRE_OFFSET) SNAPSHOT_WIRE_TANKS_COUNT,
+    SNAPSHOT_HEADER_SIZE
+};
+enum { TANK_WIRE_ID, TANK_FIELDS(TANK_WIRE_OFFSET) SNAPSHOT_TANK_SIZE };
+enum { BULLET_WIRE_ID, BULLET_FIELDS(BULLET_WIRE_OFFSET) SNAPSHOT_BULLET_SIZE };
+enum { ENTITY_EVENT_FIELDS(EVENT_WIRE_OFFSET) ENTITY_EVENT_SIZE };
+
+void protocol_dump_layout(FILE *fp);
+
+/*
+ * I32 fields of the records, a single load or store plus a byte swap on
+ * little-endian hosts instead of four byte shifts. bin_write_i32() and
+ * bin_read_i32() stay the reference, the bench checks both agree.
+ */
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define WIRE_BSWAP32(x) __builtin_bswap32(x)
+#else
+#define WIRE_BSWAP32(x) (x)
+#endif
+
+static inline void wire_write_i32(unsigned char *buf, int val)
+{
+    uint32_t be = WIRE_BSWAP32((uint32_t)val);
+    memcpy(buf, &be, sizeof(be));
+}
+
+static inline int snapshot_view_read_i32(const unsigned char *buf)
+{
+    uint32_t be;
+    memcpy(&be, buf, sizeof(be));
+    return (int)WIRE_BSWAP32(be);
+}
+
+#define WIRE_READ_I32(p)     snapshot_view_read_i32(p)
+#define WIRE_READ_U8(p)      (*(p))
+#define WIRE_READ_PRESENT(p) ((void)(p), 1)
+
+/*
+ * Accessors, generated from the schemas and inlined as they run once per
+ * field per entity per frame: snapshot_view_<header field>(view),
+ * snapshot_view_tank_<field>(view, i) and snapshot_view_bullet_<field>(view,
+ * i) with i below the tanks or bullets count.
+ */
+#define HEADER_VIEW_ACCESSOR(type, name, member, codec)                  \
+    static inline type snapshot_view_##name(const Snapshot_View *view)   \
+    {                                                                    \
+        return WIRE_READ_##codec(view->body + SNAPSHOT_WIRE_##name);     \
+    }
+#define TANK_VIEW_ACCESSOR(type, name, codec)                              \
+    static inline type snapshot_view_tank_##name(const Snapshot_View *view, \
+                                                 size_t i)                  \
+    {                                                                       \
+        return WIRE_READ_##codec(view->tanks + i * SNAPSHOT_TANK_SIZE +     \
+                                 TANK_WIRE_##name);                         \
+    }
+#define BULLET_VIEW_ACCESSOR(type, name, codec)                       \
+    static inline type snapshot_view_bullet_##name(                   \
+        const Snapshot_View *view, size_t i)                          \
+    {                                                                 \
+        return WIRE_READ_##codec(view->bullets +                      \
+                                 i * SNAPSHOT_BULLET_SIZE +           \
+                                 BULLET_WIRE_##name);                 \
+    }
+
+SNAPSHOT_HEADER_FIELDS(HEADER_VIEW_ACCESSOR)
+TANK_FIELDS(TANK_VIEW_ACCESSOR)
+BULLET_FIELDS(BULLET_VIEW_ACCESSOR)
+
+static inline size_t snapshot_view_tank_id(const Snapshot_View *view, size_t i)
+{
+    return view->tanks[i * SNAPSHOT_TANK_SIZE + TANK_WIRE_ID];
+}
+
+// Copies the schema fields of a tank record, the rest of `tank` is untouched
+static inline void snapshot_view_tank(const Snapshot_View *view, size_t i,
+                                      Tank *tank)
+{
+#define READ_FIELD(type, name, codec) \
+    tank->name = snapshot_view_tank_##name(view, i);
+    TANK_FIELDS(READ_FIELD)
+#undef READ_FIELD
+}
+
+static inline size_t snapshot_view_bullet_owner(const Snapshot_View *view,
+                                                size_t i)
+{
+    return view->bullets[i * SNAPSHOT_BULLET_SIZE + BULLET_WIRE_ID] /
+           MAX_AMMO;
+}
+
 #endif
@@ -1,6 +1,7 @@
 #include "sprite.h"
 
 #include <dirent.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -8,10 +9,15 @@
 #include <sys/types.h>
 
 #include "raylib.h"
+#include "rlgl.h"
 
 static float scalings[SPRITES_COUNT] = {0.12f, 0.06f, 0.12f};
+// Rough size on screen of the sprites of each kind, for their placeholders
+static float placeholder_sizes[SPRITES_COUNT] = {68.0f, 20.0f, 40.0f};
 
-struct sprite sprite_load(const char *path, Sprite_Kind kind, float scaling)
+// Everything but the texture, loaded separately or packed in an atlas
+static struct sprite sprite_new(const char *path, Sprite_Kind kind,
+                                float scaling)
 {
     struct sprite sprite;
     const char *subpath = kind == SPACESHIP ? SPRITE_SPACESHIP_PATH
@@ -23,37 +29,199 @@ struct sprite sprite_load(const char *path, Sprite_Kind kind, float scaling)
 
     sprite.kind    = kind;
     sprite.scaling = scaling;
-    sprite.texture = LoadTexture(sprite.path);
+    sprite.texture = (Texture2D){0};
+    sprite.source  = (Rectangle){0};
 
     return sprite;
 }
 
-void sprite_render(const struct sprite *sprite, float x, float y, Color tint)
+static void sprite_load_texture(struct sprite *sprite)
+{
+    sprite->texture = LoadTexture(sprite->path);
+    sprite->source  = (Rectangle){0.0f, 0.0f, (float)sprite->texture.width,
+                                  (float)sprite->texture.height};
+}
+
+struct sprite sprite_load(const char *path, Sprite_Kind kind, float scaling)
+{
+    struct sprite sprite = sprite_new(path, kind, scaling);
+    sprite_load_texture(&sprite);
+    return sprite;
+}
+
+/*
+ * Resolves the sprite once for drawing, the scaled size and the center are
+ * computed here rather than for every quad. A NULL sprite gives an empty
+ * handle, drawing nothing.
+ */
+Sprite_Handle sprite_handle(const struct sprite *sprite)
 {
-    Vector2 position = {(int)x, (int)y};
-    DrawTextureEx(sprite->texture, position, 0.0f, sprite->scaling, tint);
+    if (!sprite) return (Sprite_Handle){0};
+    float width  = sprite->source.width * sprite->scaling;
+    float height = sprite->source.height * sprite->scaling;
+    return (Sprite_Handle){.texture = sprite->texture,
+                           .source  = sprite->source,
+                           .size    = {width, height},
+                           .origin  = {width / 2.0f, height / 2.0f}};
 }
 
 /*
- * This function allows the rendering of a texture with rotation from its
- * center: Raylib by default rotates textures from the top-left corner.
+ * Stand-in for a sprite not loaded yet, or missing: a plain square about its
+ * size, drawn with the default white texture of raylib so that it batches
+ * like any other sprite.
  */
+Sprite_Handle sprite_placeholder(Sprite_Kind kind)
+{
+    float size = placeholder_sizes[kind];
+    return (Sprite_Handle){
+        .texture = {.id      = rlGetTextureIdDefault(),
+                    .width   = 1,
+                    .height  = 1,
+                    .mipmaps = 1,
+                    .format  = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8},
+        .source  = {0.0f, 0.0f, 1.0f, 1.0f},
+        .size    = {size, size},
+        .origin  = {size / 2.0f, size / 2.0f}};
+}
+
+// Top-left corner at x, y, no rotation
+static Sprite_Quad sprite_quad(const Sprite_Handle *handle, float x, float y,
+                               Color tint)
+{
+    return (Sprite_Quad){
+        .texture  = handle->texture,
+        .source   = handle->source,
+        .dest     = {(int)x, (int)y, handle->size.x, handle->size.y},
+        .origin   = {0.0f, 0.0f},
+        .rotation = 0.0f,
+        .tint     = tint};
+}
+
+/*
+ * Centered at x, y and rotated around the center: Raylib by default rotates
+ * textures from the top-left corner.
+ */
+static Sprite_Quad sprite_quad_rotated(const Sprite_Handle *handle, float x,
+                                       float y, float rotation)
+{
+    return (Sprite_Quad){.texture  = handle->texture,
+                         .source   = handle->source,
+                         .dest     = {x, y, handle->size.x, handle->size.y},
+                         .origin   = handle->origin,
+                         .rotation = rotation,
+                         .tint     = WHITE};
+}
+
+static void draw_quad(const Sprite_Quad *quad)
+{
+    DrawTexturePro(quad->texture, quad->source, quad->dest, quad->origin,
+                   quad->rotation, quad->tint);
+}
+
+void sprite_render(const struct sprite *sprite, float x, float y, Color tint)
+{
+    Sprite_Handle handle = sprite_handle(sprite);
+    Sprite_Quad quad     = sprite_quad(&handle, x, y, tint);
+    draw_quad(&quad);
+}
+
 void sprite_render_rotated(const struct sprite *sprite, float x, float y,
                            float rotation)
 {
-    Rectangle src_rec = {0.0f, 0.0f, (float)sprite->texture.width,
-                         (float)sprite->texture.height};
+    Sprite_Handle handle = sprite_handle(sprite);
+    Sprite_Quad quad     = sprite_quad_rotated(&handle, x, y, rotation);
+    draw_quad(&quad);
+}
 
-    // Define destination rectangle (where and how to draw the texture)
-    Rectangle dst_rec = {
-        x, y, sprite->texture.width * sprite->scaling,
-        sprite->texture.height * sprite->scaling};  // Position and
+/*
+ * BATCHED RENDERING
+ * =================
+ * Same quads as the immediate functions above, queued and emitted straight
+ * into the raylib render batch on flush, binding each texture once per run.
+ */
+void sprite_batch_begin(Sprite_Batch *batch)
+{
+    batch->count      = 0;
+    batch->draw_calls = 0;
+    batch->quads      = 0;
+}
+
+static void sprite_batch_push(Sprite_Batch *batch, const Sprite_Quad *quad)
+{
+    // Nothing to draw, as DrawTexturePro() does with missing textures
+    if (quad->texture.id == 0) return;
+    if (batch->count == SPRITE_BATCH_QUADS) sprite_batch_flush(batch);
+    batch->queue[batch->count++] = *quad;
+}
+
+void sprite_batch_render(Sprite_Batch *batch, const Sprite_Handle *handle,
+                         float x, float y, Color tint)
+{
+    Sprite_Quad quad = sprite_quad(handle, x, y, tint);
+    sprite_batch_push(batch, &quad);
+}
+
+void sprite_batch_render_rotated(Sprite_Batch *batch,
+                                 const Sprite_Handle *handle, float x, float y,
+                                 float rotation)
+{
+    Sprite_Quad quad = sprite_quad_rotated(handle, x, y, rotation);
+    sprite_batch_push(batch, &quad);
+}
+
+// The vertices DrawTexturePro() would emit for the quad, texture bound
+// already
+static void emit_quad(const Sprite_Quad *quad)
+{
+    float width  = quad->texture.width;
+    float height = quad->texture.height;
+    float sin_r  = sinf(quad->rotation * DEG2RAD);
+    float cos_r  = cosf(quad->rotation * DEG2RAD);
+    float left   = -quad->origin.x, right = left + quad->dest.width;
+    float top    = -quad->origin.y, bottom = top + quad->dest.height;
+    float u0     = quad->source.x / width;
+    float v0     = quad->source.y / height;
+    float u1     = (quad->source.x + quad->source.width) / width;
+    float v1     = (quad->source.y + quad->source.height) / height;
 
-    // Define origin for rotation (center of the texture)
-    Vector2 origin = {(sprite->texture.width * sprite->scaling) / 2.0f,
-                      (sprite->texture.height * sprite->scaling) / 2.0f};
+#define CORNER(cx, cy)                                         \
+    rlVertex2f(quad->dest.x + (cx) * cos_r - (cy) * sin_r,     \
+               quad->dest.y + (cx) * sin_r + (cy) * cos_r)
 
-    DrawTexturePro(sprite->texture, src_rec, dst_rec, origin, rotation, WHITE);
+    rlColor4ub(quad->tint.r, quad->tint.g, quad->tint.b, quad->tint.a);
+    rlNormal3f(0.0f, 0.0f, 1.0f);
+    rlTexCoord2f(u0, v0);
+    CORNER(left, top);
+    rlTexCoord2f(u0, v1);
+    CORNER(left, bottom);
+    rlTexCoord2f(u1, v1);
+    CORNER(right, bottom);
+    rlTexCoord2f(u1, v0);
+    CORNER(right, top);
+
+#undef CORNER
+}
+
+void sprite_batch_flush(Sprite_Batch *batch)
+{
+    if (batch->count == 0) return;
+
+    // Make room for the whole queue upfront, raylib would otherwise split it
+    // in two draw calls when its buffer fills up midway
+    rlCheckRenderBatchLimit(4 * batch->count);
+    for (size_t i = 0; i < batch->count;) {
+        unsigned texture = batch->queue[i].texture.id;
+        rlSetTexture(texture);
+        rlBegin(RL_QUADS);
+        for (; i < batch->count && batch->queue[i].texture.id == texture; ++i)
+            emit_quad(&batch->queue[i]);
+        rlEnd();
+        batch->draw_calls++;
+    }
+    rlSetTexture(0);
+
+    batch->quads += batch->count;
+    batch->count  = 0;
 }
 
 Sprite_Collection sprite_collection_new(void)
@@ -74,8 +242,9 @@ static void sprite_collection_add(Sprite_Collection *collection,
     collection->sprites[collection->count++] = sprite;
 }
 
-// Scans the assets directory on the FS for textures
-int sprite_collection_load(Sprite_Collection *collection, Sprite_Kind kind)
+// Scans the assets directory on the FS for textures, loading them if `load`
+static int sprite_collection_scan(Sprite_Collection *collection,
+                                  Sprite_Kind kind, bool load)
 {
     if (kind >= SPRITES_COUNT) return -1;
     char pathbuf[TEXTURE_PATH_SIZE];
@@ -100,7 +269,8 @@ int sprite_collection_load(Sprite_Collection *collection, Sprite_Kind kind)
         const char *dot = strrchr(namelist[i]->d_name, '.');
         if (strncmp(dot, ".png", 4) == 0) {
             struct sprite s =
-                sprite_load(namelist[i]->d_name, kind, scalings[kind]);
+                load ? sprite_load(namelist[i]->d_name, kind, scalings[kind])
+                     : sprite_new(namelist[i]->d_name, kind, scalings[kind]);
             sprite_collection_add(collection, s);
         }
 
@@ -116,6 +286,11 @@ exit:
     return err;
 }
 
+int sprite_collection_load(Sprite_Collection *collection, Sprite_Kind kind)
+{
+    return sprite_collection_scan(collection, kind, true);
+}
+
 void sprite_collection_unload(Sprite_Collection *collection)
 {
     for (size_t i = 0; i < collection->count; ++i)
@@ -130,36 +305,239 @@ void sprite_collection_free(Sprite_Collection *collection)
 int sprite_collection_get(const Sprite_Collection *collection,
                           struct sprite *sprite, size_t i)
 {
-    if (i >= collection->capacity) return -1;
+    if (i >= collection->count) return -1;
 
     *sprite = collection->sprites[i];
     return 0;
 }
 
-void sprite_repo_load(Sprite_Repo *repo)
+size_t sprite_repo_count(const Sprite_Repo *repo)
 {
-    int err = 0;
+    size_t total = 0;
+    for (Sprite_Kind kind = SPACESHIP; kind < SPRITES_COUNT; ++kind)
+        total += repo->collections[kind].count;
+    return total;
+}
+
+// Lists the sprites in the assets directories without loading any texture
+void sprite_repo_scan(Sprite_Repo *repo)
+{
+    int err     = 0;
+    repo->atlas = (Texture2D){0};
     for (Sprite_Kind kind = SPACESHIP; kind < SPRITES_COUNT; ++kind) {
         repo->collections[kind] = sprite_collection_new();
-        err = sprite_collection_load(&repo->collections[kind], kind);
+        err = sprite_collection_scan(&repo->collections[kind], kind, false);
         if (err < 0)
             fprintf(stderr, "error loading sprites of kind [%d]\n", kind);
     }
 }
 
-void sprite_repo_get(const Sprite_Repo *repo, struct sprite *sprite,
-                     Sprite_Kind kind, size_t i)
+/*
+ * Packs the images of the sprites of every collection in a single RGBA
+ * image, in rows left to right in repo order, a new row starting when the
+ * next sprite doesn't fit in ATLAS_WIDTH. `placed` gets where each sprite
+ * landed, in repo order, it must hold sprite_repo_count() rectangles.
+ * Images are read straight from the files, nothing touches the GPU. Returns
+ * -1 if there's nothing to pack or an image can't be read.
+ */
+int sprite_repo_build_atlas(const Sprite_Repo *repo, Image *atlas,
+                            Rectangle *placed)
+{
+    size_t total = sprite_repo_count(repo), n = 0;
+    if (total == 0) return -1;
+
+    int err       = -1;
+    int x         = 0, y = 0, row = 0, width = 0;
+    Image *images = calloc(total, sizeof(*images));
+    if (!images) return -1;
+
+    for (Sprite_Kind kind = SPACESHIP; kind < SPRITES_COUNT; ++kind) {
+        const Sprite_Collection *collection = &repo->collections[kind];
+        for (size_t i = 0; i < collection->count; ++i) {
+            Image image = LoadImage(collection->sprites[i].path);
+            if (!IsImageReady(image)) goto exit;
+            int w = image.width + 2 * ATLAS_PADDING;
+            int h = image.height + 2 * ATLAS_PADDING;
+            if (x > 0 && x + w > ATLAS_WIDTH) {
+                y  += row;
+                x   = 0;
+                row = 0;
+            }
+            placed[n]   = (Rectangle){x + ATLAS_PADDING, y + ATLAS_PADDING,
+                                      image.width, image.height};
+            images[n++] = image;
+            x          += w;
+            if (h > row) row = h;
+            if (x > width) width = x;
+        }
+    }
+
+    *atlas = GenImageColor(width, y + row, BLANK);
+    for (size_t i = 0; i < n; ++i)
+        ImageDraw(atlas, images[i],
+                  (Rectangle){0, 0, images[i].width, images[i].height},
+                  placed[i], WHITE);
+    err = 0;
+
+exit:
+    for (size_t i = 0; i < n; ++i) UnloadImage(images[i]);
+    free(images);
+    return err;
+}
+
+// Points every sprite of the repo to its place in the atlas, `placed` in
+// repo order
+static void sprite_repo_assign(Sprite_Repo *repo, Texture2D atlas,
+                               const Rectangle *placed)
+{
+    size_t n    = 0;
+    repo->atlas = atlas;
+    for (Sprite_Kind kind = SPACESHIP; kind < SPRITES_COUNT; ++kind) {
+        Sprite_Collection *collection = &repo->collections[kind];
+        for (size_t i = 0; i < collection->count; ++i) {
+            collection->sprites[i].texture = atlas;
+            collection->sprites[i].source  = placed[n++];
+        }
+    }
+}
+
+/*
+ * Lays the sprites out of a pack baked by battletank-pack: the file is mapped
+ * and the atlas image points straight into the mapping, no directory is
+ * walked and no image decoded. Returns -1 if the pack is missing or invalid,
+ * the repo is left empty and nothing mapped then.
+ */
+static int sprite_repo_stage_pack(Sprite_Repo *repo, const char *path,
+                                  Sprite_Staging *staging)
+{
+    Asset_Pack *pack = &staging->pack;
+    if (asset_pack_open(pack, path) < 0) return -1;
+
+    const Asset_Pack_Header *header = pack->header;
+    if (header->entries == 0 ||
+        header->format != PIXELFORMAT_UNCOMPRESSED_R8G8B8A8 ||
+        header->pixels_size != (uint64_t)header->width * header->height * 4)
+        goto err;
+    for (uint32_t i = 0; i < header->entries; ++i)
+        if (pack->entries[i].kind >= SPRITES_COUNT) goto err;
+
+    staging->placed = calloc(header->entries, sizeof(*staging->placed));
+    if (!staging->placed) goto err;
+    for (Sprite_Kind kind = SPACESHIP; kind < SPRITES_COUNT; ++kind)
+        repo->collections[kind] = sprite_collection_new();
+
+    // Entries are grouped by kind, as sprite_repo_build_atlas lays them out
+    size_t n = 0;
+    for (Sprite_Kind kind = SPACESHIP; kind < SPRITES_COUNT; ++kind) {
+        for (uint32_t i = 0; i < header->entries; ++i) {
+            const Asset_Pack_Entry *entry = &pack->entries[i];
+            if (entry->kind != kind) continue;
+            sprite_collection_add(
+                &repo->collections[kind],
+                sprite_new(entry->name, kind, scalings[kind]));
+            staging->placed[n++] = (Rectangle){entry->x, entry->y,
+                                               entry->width, entry->height};
+        }
+    }
+
+    // raylib only reads the pixels, mapped read-only
+    staging->image  = (Image){.data    = (void *)pack->pixels,
+                              .width   = header->width,
+                              .height  = header->height,
+                              .mipmaps = 1,
+                              .format  = header->format};
+    staging->mapped = true;
+    return 0;
+
+err:
+
+    asset_pack_close(pack);
+    return -1;
+}
+
+/*
+ * The CPU side of loading, nothing touches the GPU so it can run on any
+ * thread: the sprites are laid out of the baked pack if there's a valid
+ * one, otherwise scanned from the assets directories and their images
+ * decoded and packed in an atlas. Returns -1 if there's no atlas to upload,
+ * the sprites scanned are still listed in the repo then.
+ */
+int sprite_repo_stage(Sprite_Repo *repo, Sprite_Staging *staging)
+{
+    repo->atlas     = (Texture2D){0};
+    staging->placed = NULL;
+    staging->mapped = false;
+    if (sprite_repo_stage_pack(repo, ASSET_PACK_PATH, staging) == 0) return 0;
+
+    sprite_repo_scan(repo);
+    staging->placed = calloc(sprite_repo_count(repo), sizeof(*staging->placed));
+    if (!staging->placed) return -1;
+    if (sprite_repo_build_atlas(repo, &staging->image, staging->placed) < 0) {
+        free(staging->placed);
+        staging->placed = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * The GPU side of loading, on the thread owning the GL context: uploads the
+ * atlas staged, if any, and releases the staging. With no atlas, or if it
+ * can't be uploaded, every sprite gets a texture of its own as last resort.
+ */
+void sprite_repo_upload(Sprite_Repo *repo, Sprite_Staging *staging)
+{
+    if (staging->placed) {
+        Texture2D texture = LoadTextureFromImage(staging->image);
+        if (IsTextureReady(texture))
+            sprite_repo_assign(repo, texture, staging->placed);
+        if (staging->mapped)
+            asset_pack_close(&staging->pack);
+        else
+            UnloadImage(staging->image);
+        free(staging->placed);
+        staging->placed = NULL;
+        if (repo->atlas.id != 0) return;
+    }
+
+    // Still playable, one texture bind per sprite
+    fprintf(stderr, "error packing the sprites atlas, loading them apart\n");
+    for (Sprite_Kind kind = SPACESHIP; kind < SPRITES_COUNT; ++kind)
+        for (size_t i = 0; i < repo->collections[kind].count; ++i)
+            sprite_load_texture(&repo->collections[kind].sprites[i]);
+}
+
+// Both halves of loading in one go, on the calling thread
+void sprite_repo_load(Sprite_Repo *repo)
+{
+    Sprite_Staging staging;
+    sprite_repo_stage(repo, &staging);
+    sprite_repo_upload(repo, &staging);
+}
+
+// NULL if the repo has no such sprite
+const struct sprite *sprite_repo_get(const Sprite_Repo *repo,
+                                     Sprite_Kind kind, size_t i)
+{
+    if (kind >= SPRITES_COUNT || i >= repo->collections[kind].count)
+        return NULL;
+    return &repo->collections[kind].sprites[i];
+}
+
+// Handle to draw the sprite with, an empty one if there's no such sprite
+Sprite_Handle sprite_repo_handle(const Sprite_Repo *repo, Sprite_Kind kind,
+                                 size_t i)
 {
-    int err = sprite_collection_get(&repo->collections[kind], sprite, i);
-    if (err < 0)
-        fprintf(stderr, "failed to get sprites collection of kind %d - %ld\n",
-                kind, i);
+    return sprite_handle(sprite_repo_get(repo, kind, i));
 }
 
 void sprite_repo_free(Sprite_Repo *repo)
 {
     for (Sprite_Kind kind = SPACESHIP; kind < SPRITES_COUNT; ++kind) {
-        sprite_collection_unload(&repo->collections[kind]);
+        // Packed sprites don't own their texture
+        if (repo->atlas.id == 0)
+            sprite_collection_unload(&repo->collections[kind]);
         sprite_collection_free(&repo->collections[kind]);
     }
+    if (repo->atlas.id != 0) UnloadTexture(repo->atlas);
 }
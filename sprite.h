@@ -1,23 +1,38 @@
 #ifndef SPRITE_H
 #define SPRITE_H
 
+#include <stdbool.h>
 #include <stdio.h>
 
+#include "asset_pack.h"
 #include "raylib.h"
 
 #define ASSETS_PATH           "./assets"
+// Sprites baked by battletank-pack, loaded instead of the directories below
+#define ASSET_PACK_PATH       ASSETS_PATH "/sprites.pack"
 #define TEXTURE_PATH_SIZE     192
 #define SPRITE_SPACESHIP_PATH "spaceships"
 #define SPRITE_BULLET_PATH    "bullets"
 #define SPRITE_POWERUP_PATH   "powerups"
+// Widest row of the atlas, sprites are packed in rows up to this width
+#define ATLAS_WIDTH           2048
+// Transparent pixels around every sprite in the atlas, so that filtering
+// never samples the neighbours
+#define ATLAS_PADDING         2
+// Quads a batch holds before it has to be flushed early, a frame has at most
+// a tank and its bullets per player and the power up
+#define SPRITE_BATCH_QUADS    64
 
 typedef enum { SPACESHIP, BULLET, POWERUP, SPRITES_COUNT } Sprite_Kind;
 
+// `source` is where the pixels of the sprite are in `texture`, the whole of
+// it unless the sprite is packed in an atlas
 struct sprite {
     char path[TEXTURE_PATH_SIZE];
     float scaling;
     Sprite_Kind kind;
     Texture2D texture;
+    Rectangle source;
 };
 
 typedef struct {
@@ -26,15 +41,67 @@ typedef struct {
     struct sprite *sprites;
 } Sprite_Collection;
 
+// Sprites of a repo share the `atlas` texture once packed, its id is 0 if
+// packing failed and every sprite has its own texture instead
 typedef struct {
     Sprite_Collection collections[SPRITES_COUNT];
+    Texture2D atlas;
 } Sprite_Repo;
 
+/*
+ * What drawing a sprite takes, resolved once out of the repo and kept by the
+ * caller: `size` is the scaled size on screen, `origin` its center, the
+ * rotation pivot. A handle with a 0 texture id draws nothing.
+ */
+typedef struct {
+    Texture2D texture;
+    Rectangle source;
+    Vector2 size;
+    Vector2 origin;
+} Sprite_Handle;
+
+/*
+ * Sprites laid out in an atlas, the CPU side of loading done, waiting for
+ * the upload: `placed` is where each sprite is in `image`, in repo order,
+ * NULL if there's no atlas. The image points into the mapped `pack` if
+ * `mapped`, it's decoded and owned otherwise.
+ */
+typedef struct {
+    Image image;
+    Rectangle *placed;
+    Asset_Pack pack;
+    bool mapped;
+} Sprite_Staging;
+
+typedef struct {
+    Texture2D texture;
+    Rectangle source;
+    Rectangle dest;
+    Vector2 origin;
+    float rotation;
+    Color tint;
+} Sprite_Quad;
+
+/*
+ * Quads of a frame, queued in draw order and emitted on flush in a single
+ * pass: a texture is bound once for every run of quads sharing it, so all
+ * the sprites of an atlas go in one draw call. `draw_calls` and `quads`
+ * count what the flushes emitted since sprite_batch_begin.
+ */
+typedef struct {
+    Sprite_Quad queue[SPRITE_BATCH_QUADS];
+    size_t count;
+    int draw_calls;
+    int quads;
+} Sprite_Batch;
+
 // Granular sprite managing, loading and rendering
 struct sprite sprite_load(const char *path, Sprite_Kind kind, float scaling);
 void sprite_render(const struct sprite *sprite, float x, float y, Color tint);
 void sprite_render_rotated(const struct sprite *sprite, float x, float y,
                            float rotation);
+Sprite_Handle sprite_handle(const struct sprite *sprite);
+Sprite_Handle sprite_placeholder(Sprite_Kind kind);
 
 // Sprite collection managing
 Sprite_Collection sprite_collection_new(void);
@@ -44,9 +111,26 @@ void sprite_collection_free(Sprite_Collection *collection);
 int sprite_collection_get(const Sprite_Collection *collection,
                           struct sprite *sprite, size_t i);
 
+// Batched rendering
+void sprite_batch_begin(Sprite_Batch *batch);
+void sprite_batch_render(Sprite_Batch *batch, const Sprite_Handle *handle,
+                         float x, float y, Color tint);
+void sprite_batch_render_rotated(Sprite_Batch *batch,
+                                 const Sprite_Handle *handle, float x, float y,
+                                 float rotation);
+void sprite_batch_flush(Sprite_Batch *batch);
+
 // Sprite repo managing
 void sprite_repo_load(Sprite_Repo *repo);
-void sprite_repo_get(const Sprite_Repo *repo, struct sprite *sprite,
-                     Sprite_Kind kind, size_t i);
+int sprite_repo_stage(Sprite_Repo *repo, Sprite_Staging *staging);
+void sprite_repo_upload(Sprite_Repo *repo, Sprite_Staging *staging);
+void sprite_repo_scan(Sprite_Repo *repo);
+size_t sprite_repo_count(const Sprite_Repo *repo);
+int sprite_repo_build_atlas(const Sprite_Repo *repo, Image *atlas,
+                            Rectangle *placed);
+const struct sprite *sprite_repo_get(const Sprite_Repo *repo,
+                                     Sprite_Kind kind, size_t i);
+Sprite_Handle sprite_repo_handle(const Sprite_Repo *repo, Sprite_Kind kind,
+                                 size_t i);
 void sprite_repo_free(Sprite_Repo *repo);
 #endif
@@ -0,0 +1,51 @@
+#include "sprite_loader.h"
+
+static void *sprite_loader_run(void *arg)
+{
+    Sprite_Loader *loader = arg;
+    sprite_repo_stage(&loader->repo, &loader->staging);
+    atomic_store_explicit(&loader->staged, true, memory_order_release);
+    return NULL;
+}
+
+// Starts staging the sprites in the background, -1 if the worker can't be
+// started, in which case polling and waiting do nothing
+int sprite_loader_start(Sprite_Loader *loader)
+{
+    atomic_init(&loader->staged, false);
+    loader->finished = false;
+    if (pthread_create(&loader->thread, NULL, sprite_loader_run, loader) != 0) {
+        loader->finished = true;
+        return -1;
+    }
+    return 0;
+}
+
+// Uploads what the worker staged and hands the sprites over to `repo`
+static void sprite_loader_finish(Sprite_Loader *loader, Sprite_Repo *repo)
+{
+    pthread_join(loader->thread, NULL);
+    sprite_repo_upload(&loader->repo, &loader->staging);
+    *repo            = loader->repo;
+    loader->finished = true;
+}
+
+/*
+ * Doesn't block, true once: at the first call after the worker is done,
+ * the atlas is uploaded, which must happen on the thread owning the GL
+ * context, and the sprites are in `repo` from then on.
+ */
+bool sprite_loader_poll(Sprite_Loader *loader, Sprite_Repo *repo)
+{
+    if (loader->finished ||
+        !atomic_load_explicit(&loader->staged, memory_order_acquire))
+        return false;
+    sprite_loader_finish(loader, repo);
+    return true;
+}
+
+// Blocks until the sprites are in `repo`, if they aren't already
+void sprite_loader_wait(Sprite_Loader *loader, Sprite_Repo *repo)
+{
+    if (!loader->finished) sprite_loader_finish(loader, repo);
+}
@@ -0,0 +1,29 @@
+#ifndef SPRITE_LOADER_H
+#define SPRITE_LOADER_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "sprite.h"
+
+/*
+ * Sprites staged on a worker thread while the main one carries on, connecting
+ * and syncing with the server: the pack is mapped or the images decoded off
+ * the main thread, only the upload of the atlas is left to it, as the GL
+ * context lives there. `staged` is set by the worker once it's done,
+ * `finished` once the repo is handed over.
+ */
+typedef struct {
+    Sprite_Repo repo;
+    Sprite_Staging staging;
+    pthread_t thread;
+    atomic_bool staged;
+    bool finished;
+} Sprite_Loader;
+
+int sprite_loader_start(Sprite_Loader *loader);
+bool sprite_loader_poll(Sprite_Loader *loader, Sprite_Repo *repo);
+void sprite_loader_wait(Sprite_Loader *loader, Sprite_Repo *repo);
+
+#endif
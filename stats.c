@@ -0,0 +1,45 @@
+#include "stats.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int compare_floats(const void *a, const void *b)
+{
+    float x = *(const float *)a, y = *(const float *)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest rank, `sorted` holds `count` samples, at least one
+static float percentile(const float *sorted, size_t count, float p)
+{
+    size_t rank = ceilf(p * count);
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+// Sorts a copy of the samples, the ring is left as it is
+void stats_ring_summarize(const Stats_Ring *ring, Stats_Summary *summary)
+{
+    float sorted[STATS_RING_SIZE];
+    size_t count = ring->count < STATS_RING_SIZE ? ring->count : STATS_RING_SIZE;
+
+    memset(summary, 0x00, sizeof(*summary));
+    if (count == 0) return;
+
+    memcpy(sorted, ring->samples, count * sizeof(float));
+    qsort(sorted, count, sizeof(float), compare_floats);
+
+    double sum = 0.0, squares = 0.0;
+    for (size_t i = 0; i < count; ++i) sum += sorted[i];
+    double mean = sum / count;
+    for (size_t i = 0; i < count; ++i)
+        squares += (sorted[i] - mean) * (sorted[i] - mean);
+
+    summary->count  = count;
+    summary->mean   = mean;
+    summary->stddev = sqrt(squares / count);
+    summary->p50    = percentile(sorted, count, 0.50f);
+    summary->p95    = percentile(sorted, count, 0.95f);
+    summary->p99    = percentile(sorted, count, 0.99f);
+    summary->max    = sorted[count - 1];
+}
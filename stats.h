@@ -0,0 +1,37 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+
+// Samples a ring keeps, the latest ones, ~1s of frames at 120 FPS
+#define STATS_RING_SIZE 128
+
+/*
+ * Fixed size ring of the latest samples of a measure, pushing one is a store
+ * and an increment, all the math is left to stats_ring_summarize, to run only
+ * when the numbers are looked at.
+ */
+typedef struct {
+    float samples[STATS_RING_SIZE];
+    size_t count;
+} Stats_Ring;
+
+// Distribution of the samples in a ring, all 0 while it's empty
+typedef struct {
+    size_t count;
+    float mean;
+    float stddev;
+    float p50;
+    float p95;
+    float p99;
+    float max;
+} Stats_Summary;
+
+static inline void stats_ring_push(Stats_Ring *ring, float sample)
+{
+    ring->samples[ring->count++ % STATS_RING_SIZE] = sample;
+}
+
+void stats_ring_summarize(const Stats_Ring *ring, Stats_Summary *summary);
+
+#endif